@@ -442,6 +442,38 @@ rectangle 0, 0, texture_width, texture_height
  */
 movie_texture_relative(name:text, width:real, height:real);
 
+/**
+ * @~english
+ * Creates a texture from a rectangle of a video.
+ * This function is similar to @ref movie_texture(name:text), but only
+ * the rectangle of size @p w x @p h at @p x, @p y (top left corner, in
+ * pixels of the video) is shown. @c texture_width and @c texture_height
+ * are the size of the rectangle.
+ * Only that part of each frame is uploaded to the graphics card, so the
+ * cost of a crop of a large video depends on the size of the crop.
+ * The rectangle can be animated. For example, to pan across a 4K video:
+ * @~french
+ * Crée une texture à partir d'un rectangle d'une vidéo.
+ * Cette fonction est similaire à @ref movie_texture(name:text), mais seul
+ * le rectangle de taille @p w x @p h situé en @p x, @p y (coin supérieur
+ * gauche, en pixels de la vidéo) est affiché. @c texture_width et
+ * @c texture_height sont la taille du rectangle.
+ * Seule cette partie de chaque image est transférée vers la carte
+ * graphique, si bien que le coût d'un recadrage d'une grande vidéo
+ * dépend de la taille du recadrage.
+ * Le rectangle peut être animé. Par exemple, pour parcourir une vidéo 4K :
+ * @~
+@code
+import VLCAudioVideo 1.078
+color "white"
+movie_texture_region "camera.mov", 1000 + 500 * sin time, 600, 1280, 720
+rectangle 0, 0, texture_width, texture_height
+@endcode
+ * @see movie_set_region, movie_texture(name:text)
+ * @since 1.078
+ */
+movie_texture_region(name:text, x:real, y:real, w:real, h:real);
+
 /**
  * @~english
  * Plays video in the Tao window with best performance.
@@ -685,6 +717,73 @@ movie_length(name:text);
  */
 movie_rate(name:text);
 
+/**
+ * @~english
+ * Return the measured frame rate of a given movie.
+ * The number of frames per second actually delivered by the decoder for
+ * the current video stream, averaged over the last frames. It is lower
+ * than the frame rate of the video when decoding falls behind, and
+ * follows the @ref movie_set_rate "playback rate".
+ * The @p name parameter specifies the name of the movie.
+ * The function returns -1.0 if @p name is unknown, and 0.0 when the movie
+ * has no video or the rate is not known yet.
+ * @~french
+ * Renvoie la fréquence d'images mesurée d'un flux multimédia.
+ * Le nombre d'images par seconde effectivement fournies par le décodeur
+ * pour le flux vidéo courant, en moyenne sur les dernières images. Elle
+ * est inférieure à la fréquence d'images de la vidéo quand le décodage
+ * prend du retard, et suit la @ref movie_set_rate "vitesse de lecture".
+ * @p name est le nom du fichier ou l'URL de la ressource multimédia.
+ * Cette fonction renvoie -1.0 si @p name est inconnu, et 0.0 si le flux
+ * n'a pas de vidéo ou si la fréquence n'est pas encore connue.
+ * @~
+ * @see movie_rate.
+ * @since 1.081
+ */
+movie_fps(name:text);
+
+/**
+ * @~english
+ * Return how far a movie is ahead of its sync group.
+ * The offset, in seconds, between the time of the movie and the clock of
+ * the group it belongs to. It is negative when the movie is late.
+ * The @p name parameter specifies the name of the movie.
+ * The function returns 0.0 if @p name is unknown or not in a group.
+ * @~french
+ * Renvoie l'avance d'un flux multimédia sur son groupe de synchronisation.
+ * L'écart, en secondes, entre le temps du flux et l'horloge du groupe
+ * auquel il appartient. Il est négatif quand le flux est en retard.
+ * @p name est le nom du fichier ou l'URL de la ressource multimédia.
+ * Cette fonction renvoie 0.0 si @p name est inconnu ou n'est dans aucun
+ * groupe.
+ * @~
+ * @see movie_sync_group.
+ * @since 1.082
+ */
+movie_sync_offset(name:text);
+
+/**
+ * @~english
+ * Return the time spent to convert and upload a frame of a movie.
+ * The average, in microseconds, of the CPU time spent converting a frame
+ * and transferring it to the graphics card. It lets you compare scaling
+ * by the GPU and by VLC, see @ref movie_set_gpu_scaling.
+ * The @p name parameter specifies the name of the movie.
+ * The function returns -1.0 if @p name is unknown.
+ * @~french
+ * Renvoie le temps passé à convertir et transférer une image d'une vidéo.
+ * La moyenne, en microsecondes, du temps processeur passé à convertir une
+ * image et à la transférer vers la carte graphique. Cela permet de
+ * comparer la mise à l'échelle par le GPU et par VLC, voir
+ * @ref movie_set_gpu_scaling.
+ * @p name est le nom du fichier ou l'URL de la ressource multimédia.
+ * Cette fonction renvoie -1.0 si @p name est inconnu.
+ * @~
+ * @see movie_set_gpu_scaling.
+ * @since 1.079
+ */
+movie_upload_time(name:text);
+
 /**
  * @~english
  * Returns true if the movie is currently playing.
@@ -832,6 +931,210 @@ movie_set_rate(name:text, rate:real);
 movie_set_loop(name:text, mode:boolean);
 
 
+/**
+ * @~english
+ * Sets the rectangle of a video shown in its texture.
+ * The @p name parameter specifies the name of the movie.
+ * The @ref RegExp "re:" syntax is supported.
+ * @p x, @p y is the top left corner of the rectangle, and @p w, @p h its
+ * size, in pixels of the video. The whole video is shown again if @p w or
+ * @p h is 0. Only the rectangle is uploaded to the graphics card.
+ * @~french
+ * Choisit le rectangle d'une vidéo affiché dans sa texture.
+ * @p name est le nom du fichier ou l'URL de la ressource multimédia.
+ * La syntaxe @ref RegExp "re:" est supportée.
+ * @p x, @p y est le coin supérieur gauche du rectangle, et @p w, @p h sa
+ * taille, en pixels de la vidéo. La vidéo entière est de nouveau affichée
+ * si @p w ou @p h vaut 0. Seul le rectangle est transféré vers la carte
+ * graphique.
+ * @~
+ * @see movie_texture_region.
+ * @since 1.078
+ */
+movie_set_region(name:text, x:real, y:real, w:real, h:real);
+
+
+/**
+ * @~english
+ * Chooses how a movie is scaled to the size of its texture.
+ * The @p name parameter specifies the name of the movie.
+ * The @ref RegExp "re:" syntax is supported.
+ * If @p mode is true, the video is decoded at its native size and the
+ * graphics card scales it when drawing, with mipmaps when it shrinks.
+ * Otherwise, VLC scales each frame before it is uploaded (the default).
+ * This only applies to movies with a texture size, as set by
+ * @ref movie_texture(name:text, width:integer, height:integer) or
+ * @ref movie_texture_relative. Playback resumes at the next keyframe.
+ * Setting the @c TAO_VLC_GPU_SCALE environment variable selects GPU
+ * scaling for all movies.
+ * @~french
+ * Choisit comment une vidéo est mise à la taille de sa texture.
+ * @p name est le nom du fichier ou l'URL de la ressource multimédia.
+ * La syntaxe @ref RegExp "re:" est supportée.
+ * Si @p mode est @a true, la vidéo est décodée à sa taille d'origine et la
+ * carte graphique la met à l'échelle à l'affichage, avec des mipmaps
+ * lorsqu'elle est réduite. Sinon, VLC met chaque image à l'échelle avant
+ * de la transférer (comportement par défaut).
+ * Cela ne s'applique qu'aux vidéos dont la taille de texture est fixée par
+ * @ref movie_texture(name:text, width:integer, height:integer) ou
+ * @ref movie_texture_relative. La lecture reprend à l'image clé suivante.
+ * La variable d'environnement @c TAO_VLC_GPU_SCALE choisit la mise à
+ * l'échelle par le GPU pour toutes les vidéos.
+ * @~
+ * @see movie_upload_time.
+ * @since 1.079
+ */
+movie_set_gpu_scaling(name:text, mode:boolean);
+
+
+/**
+ * @~english
+ * Replays a looping movie from memory.
+ * The @p name parameter specifies the name of the movie.
+ * The @ref RegExp "re:" syntax is supported.
+ * The frames of the next pass of the movie are recorded, in memory or in
+ * a temporary file when @p max_mb is larger than 256. The following
+ * passes show the recorded frames without decoding the movie again.
+ * This is meant for short background clips in @ref movie_set_loop "loop"
+ * mode: the sound is not played again, and recording is abandoned if
+ * the frames need more than @p max_mb megabytes. A value of 0 stops
+ * replaying from memory.
+ * @~french
+ * Rejoue une vidéo en boucle depuis la mémoire.
+ * @p name est le nom du fichier ou l'URL de la ressource multimédia.
+ * La syntaxe @ref RegExp "re:" est supportée.
+ * Les images du passage suivant de la vidéo sont enregistrées, en mémoire
+ * ou dans un fichier temporaire si @p max_mb dépasse 256. Les passages
+ * suivants affichent les images enregistrées sans décoder à nouveau la
+ * vidéo. Cette fonction est destinée aux courtes vidéos d'arrière-plan
+ * lues en @ref movie_set_loop "boucle" : le son n'est pas rejoué, et
+ * l'enregistrement est abandonné si les images occupent plus de @p max_mb
+ * mégaoctets. La valeur 0 arrête la relecture depuis la mémoire.
+ * @~
+ * @see movie_set_loop.
+ * @since 1.080
+ */
+movie_cache_loop(name:text, max_mb:integer);
+
+
+/**
+ * @~english
+ * Plays movies on a common clock.
+ * The @p name parameter specifies the name of the movie.
+ * The @ref RegExp "re:" syntax is supported.
+ * All the movies in the group called @p group follow the same clock,
+ * for instance to show the tiles of a video wall. Movies wait on their
+ * first image until all of them play, or for 3 seconds, then the clock
+ * starts. It stops while all movies are paused. Seeking or changing the
+ * rate of a movie does the same for the clock. Movies that start later,
+ * or are more than half a second away from the clock, seek to it.
+ * Smaller differences are corrected by playing the movie up to 5% faster
+ * or slower than its rate. Looping movies follow the clock modulo their
+ * length. An empty @p group removes the movie from its group, which
+ * restores its rate.
+ * @~french
+ * Joue des flux multimédia sur une horloge commune.
+ * @p name est le nom du fichier ou l'URL de la ressource multimédia.
+ * La syntaxe @ref RegExp "re:" est supportée.
+ * Tous les flux du groupe appelé @p group suivent la même horloge, par
+ * exemple pour afficher les éléments d'un mur d'images. Les flux
+ * attendent sur leur première image que tous soient lus, ou pendant 3
+ * secondes, puis l'horloge démarre. Elle s'arrête tant que tous les flux
+ * sont en pause. Se positionner ou changer la vitesse d'un flux fait de
+ * même pour l'horloge. Les flux qui démarrent plus tard, ou qui
+ * s'écartent de l'horloge de plus d'une demi-seconde, s'y repositionnent.
+ * Les écarts plus faibles sont corrigés en jouant le flux jusqu'à 5% plus
+ * vite ou plus lentement que sa vitesse. Les flux en boucle suivent
+ * l'horloge modulo leur durée. Un @p group vide retire le flux de son
+ * groupe, ce qui rétablit sa vitesse.
+ * @~
+ * @see movie_sync_offset.
+ * @since 1.082
+ */
+movie_sync_group(group:text, name:text);
+
+
+/**
+ * @~english
+ * Pauses a movie on a given frame.
+ * The @p name parameter specifies the name of the movie.
+ * The @ref RegExp "re:" syntax is supported.
+ * @p frame is the number of the frame in the video track, the first one
+ * being 0. MP4 and QuickTime files are indexed in the background the
+ * first time this is used, and the index is kept in a cache file. It gives
+ * the exact time of each frame, and its keyframes. Moving a few frames
+ * forward then decodes no more frames than needed. Until the index is
+ * ready, or for other formats, the time of the frame is computed from the
+ * frame rate of the movie.
+ * The function returns false if @p name is unknown or @p frame is not a
+ * frame of the movie.
+ * @~french
+ * Met un flux multimédia en pause sur une image donnée.
+ * @p name est le nom du fichier ou l'URL de la ressource multimédia.
+ * La syntaxe @ref RegExp "re:" est supportée.
+ * @p frame est le numéro de l'image dans la piste vidéo, la première
+ * étant 0. Les fichiers MP4 et QuickTime sont indexés en tâche de fond à
+ * la première utilisation, et l'index est conservé dans un fichier cache. Il
+ * donne l'instant exact de chaque image, et ses images clés. Avancer de
+ * quelques images ne décode alors que les images nécessaires. Tant que
+ * l'index n'est pas prêt, ou pour les autres formats, l'instant de l'image
+ * est calculé à partir de la fréquence d'images du flux.
+ * Cette fonction renvoie faux si @p name est inconnu ou si @p frame n'est
+ * pas une image du flux.
+ * @~
+ * @see movie_next_frame, movie_fps.
+ * @since 1.083
+ */
+movie_seek_frame(name:text, frame:integer);
+
+
+/**
+ * @~english
+ * Creates a texture with thumbnails of a movie.
+ * @p name is the name of a movie already created with @ref movie or
+ * @ref movie_texture. The texture is a grid of @p count thumbnails, each
+ * @p width pixels wide, with the height given by the aspect ratio of the
+ * video. Thumbnail @a k shows the movie at <tt>(k + 0.5) / count</tt> of
+ * its length. Thumbnails are left to right, then top to bottom, on
+ * @a c columns, @a c being the smallest integer whose square is at least
+ * @p count. For example, the texture coordinates of thumbnail @a k on a
+ * grid of @a c columns and @a r rows are
+ * <tt>(k mod c) / c</tt> to <tt>(k mod c + 1) / c</tt> horizontally, and
+ * <tt>1 - (k div c + 1) / r</tt> to <tt>1 - (k div c) / r</tt> vertically.
+ * Thumbnails are decoded in the background, without slowing down the
+ * movie being played, and appear as they are ready. The thumbnails of a
+ * local file are kept in a cache file, and are shown immediately the next
+ * time. @p count is at most 256, @p width at most 512 pixels. Thumbnails
+ * are made smaller so that the texture holds at most 4 million pixels.
+ * The function returns the texture ID, or 0 if @p name is unknown.
+ * @~french
+ * Crée une texture contenant des vignettes d'un flux multimédia.
+ * @p name est le nom d'un flux déjà créé par @ref movie ou
+ * @ref movie_texture. La texture est une grille de @p count vignettes,
+ * chacune de @p width pixels de large, la hauteur découlant du format de
+ * la vidéo. La vignette @a k montre le flux à <tt>(k + 0.5) / count</tt>
+ * de sa durée. Les vignettes sont placées de gauche à droite, puis de haut
+ * en bas, sur @a c colonnes, @a c étant le plus petit entier dont le carré
+ * est au moins @p count. Par exemple, les coordonnées de texture de la
+ * vignette @a k sur une grille de @a c colonnes et @a r lignes vont de
+ * <tt>(k mod c) / c</tt> à <tt>(k mod c + 1) / c</tt> horizontalement,
+ * et de <tt>1 - (k div c + 1) / r</tt> à <tt>1 - (k div c) / r</tt>
+ * verticalement.
+ * Les vignettes sont décodées en tâche de fond, sans ralentir la lecture
+ * du flux, et apparaissent dès qu'elles sont prêtes. Les vignettes d'un
+ * fichier local sont conservées dans un fichier cache, et sont affichées
+ * immédiatement la fois suivante. @p count vaut au plus 256, @p width au
+ * plus 512 pixels. Les vignettes sont réduites pour que la texture compte
+ * au plus 4 millions de pixels.
+ * Cette fonction renvoie l'identifiant de la texture, ou 0 si @p name est
+ * inconnu.
+ * @~
+ * @see movie_texture.
+ * @since 1.084
+ */
+movie_thumbnails(name:text, count:integer, width:integer);
+
+
 /**
  * @~english
  * Initializes the VLC library.
@@ -0,0 +1,238 @@
+// *****************************************************************************
+// pixel_convert_test.cpp                                          Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Check that all the kernels of convertToGLFormat produce the same bytes
+//    as the conversion loop they replaced, on random pictures.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2026, agent <agent@local>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include "vlc_pixel_convert.h"
+#include <QSysInfo>
+#include <QtGlobal>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+
+static void convertOld(uint *q, const uint *from, int width, int height)
+// ----------------------------------------------------------------------------
+//   The conversion of VlcVideoSurface before the SIMD kernels, unchanged
+// ----------------------------------------------------------------------------
+{
+    const uint *p = from + (height - 1) * width;
+    if (QSysInfo::ByteOrder == QSysInfo::BigEndian)
+    {
+        for (int i=0; i < height; ++i)
+        {
+            const uint *end = p + width;
+            while (p < end)
+            {
+                *q = (*p << 8) | ((*p >> 24) & 0xff);
+                p++;
+                q++;
+            }
+            p -= 2 * width;
+        }
+    }
+    else
+    {
+        for (int i=0; i < height; ++i)
+        {
+            const uint *end = p + width;
+            while (p < end)
+            {
+                *q = ((*p << 16) & 0xff0000) | ((*p >> 16) & 0xff)
+                                             | (*p & 0xff00ff00);
+                p++;
+                q++;
+            }
+            p -= 2 * width;
+        }
+    }
+}
+
+
+static bool checkSize(const char *kernel, unsigned w, unsigned h)
+// ----------------------------------------------------------------------------
+//   Compare whole and partial conversions of a random w x h picture
+// ----------------------------------------------------------------------------
+{
+    const uint SENTINEL = 0xdeadbeef;
+    size_t n = size_t(w) * h;
+    std::vector<uint> from(n), expected(n), actual(n);
+    for (size_t i = 0; i < n; i++)
+        from[i] = (uint(rand() & 0xffff) << 16) | uint(rand() & 0xffff);
+    convertOld(&expected[0], &from[0], w, h);
+
+    convertToGLFormat(&actual[0], &from[0], w, h);
+    if (memcmp(&expected[0], &actual[0], n * sizeof(uint)))
+    {
+        fprintf(stderr, "%s: %ux%u differs\n", kernel, w, h);
+        return false;
+    }
+
+    // A rectangle must be converted to where it is in the flipped picture,
+    // and pixels outside of it must not be written
+    unsigned x = rand() % w, y = rand() % h;
+    unsigned rw = 1 + rand() % (w - x), rh = 1 + rand() % (h - y);
+    actual.assign(n, SENTINEL);
+    convertToGLFormat(&actual[0], &from[0], w, h, x, y, rw, rh);
+    for (unsigned row = 0; row < h; row++)
+    {
+        unsigned srcRow = h - 1 - row;
+        bool inside = srcRow >= y && srcRow < y + rh;
+        for (unsigned col = 0; col < w; col++)
+        {
+            size_t i = size_t(row) * w + col;
+            bool in = inside && col >= x && col < x + rw;
+            if (actual[i] != (in ? expected[i] : SENTINEL))
+            {
+                fprintf(stderr, "%s: %ux%u, rectangle %u,%u %ux%u differs "
+                        "at %u,%u\n", kernel, w, h, x, y, rw, rh, col, row);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+static bool checkFlip16(unsigned w, unsigned h)
+// ----------------------------------------------------------------------------
+//   Check whole and partial vertical flips of a random 16-bit w x h picture
+// ----------------------------------------------------------------------------
+{
+    const ushort SENTINEL = 0xbeef;
+    size_t n = size_t(w) * h;
+    std::vector<ushort> from(n), expected(n), actual(n);
+    for (size_t i = 0; i < n; i++)
+        from[i] = ushort(rand());
+    for (unsigned row = 0; row < h; row++)
+        for (unsigned col = 0; col < w; col++)
+            expected[size_t(row) * w + col] =
+                from[size_t(h - 1 - row) * w + col];
+
+    verticalFlip16(&actual[0], &from[0], w, h);
+    if (memcmp(&expected[0], &actual[0], n * sizeof(ushort)))
+    {
+        fprintf(stderr, "flip16: %ux%u differs\n", w, h);
+        return false;
+    }
+
+    // Only the rectangle is written, to where it is in the flipped picture
+    unsigned x = rand() % w, y = rand() % h;
+    unsigned rw = 1 + rand() % (w - x), rh = 1 + rand() % (h - y);
+    actual.assign(n, SENTINEL);
+    verticalFlip16(&actual[0], &from[0], w, h, x, y, rw, rh);
+    for (unsigned row = 0; row < h; row++)
+    {
+        unsigned srcRow = h - 1 - row;
+        bool inside = srcRow >= y && srcRow < y + rh;
+        for (unsigned col = 0; col < w; col++)
+        {
+            size_t i = size_t(row) * w + col;
+            bool in = inside && col >= x && col < x + rw;
+            if (actual[i] != (in ? expected[i] : SENTINEL))
+            {
+                fprintf(stderr, "flip16: %ux%u, rectangle %u,%u %ux%u "
+                        "differs at %u,%u\n", w, h, x, y, rw, rh, col, row);
+                return false;
+            }
+        }
+    }
+
+    // Empty rectangles, or rectangles out of the picture, write nothing
+    const unsigned bad[][4] = {
+        { 0, 0, 0, h }, { 0, 0, w, 0 }, { 1, 0, w, h }, { 0, 1, w, h },
+        { w, 0, 1, 1 }, { 0, h, 1, 1 }
+    };
+    for (unsigned b = 0; b < sizeof(bad) / sizeof(*bad); b++)
+    {
+        actual.assign(n, SENTINEL);
+        verticalFlip16(&actual[0], &from[0], w, h,
+                       bad[b][0], bad[b][1], bad[b][2], bad[b][3]);
+        for (size_t i = 0; i < n; i++)
+        {
+            if (actual[i] != SENTINEL)
+            {
+                fprintf(stderr, "flip16: %ux%u, rectangle %u,%u %ux%u "
+                        "out of bounds was written\n", w, h,
+                        bad[b][0], bad[b][1], bad[b][2], bad[b][3]);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+int main()
+// ----------------------------------------------------------------------------
+//   Test all kernels supported by this CPU, return 0 if they all pass
+// ----------------------------------------------------------------------------
+{
+    static const char *kernels[] = { "scalar", "sse2", "ssse3", "avx2",
+                                     "neon" };
+    static const unsigned sizes[][2] = {
+        { 1, 1 }, { 2, 3 }, { 3, 2 }, { 7, 5 }, { 8, 8 }, { 15, 4 },
+        { 16, 9 }, { 17, 3 }, { 31, 2 }, { 33, 17 }, { 64, 4 },
+        { 127, 3 }, { 640, 360 }, { 1921, 7 }
+    };
+    const unsigned ROUNDS = 20;
+
+    srand(42);
+    int failed = 0, tested = 0;
+    for (unsigned k = 0; k < sizeof(kernels) / sizeof(*kernels); k++)
+    {
+        if (!selectPixelConvertKernel(kernels[k]))
+        {
+            printf("%-8s not supported, skipped\n", kernels[k]);
+            continue;
+        }
+        bool ok = true;
+        for (unsigned r = 0; r < ROUNDS && ok; r++)
+            for (unsigned s = 0; s < sizeof(sizes) / sizeof(*sizes); s++)
+                ok = checkSize(kernels[k], sizes[s][0], sizes[s][1]) && ok;
+        printf("%-8s %s\n", pixelConvertKernel(), ok ? "passed" : "FAILED");
+        tested++;
+        if (!ok)
+            failed++;
+    }
+
+    bool ok = true;
+    for (unsigned r = 0; r < ROUNDS && ok; r++)
+        for (unsigned s = 0; s < sizeof(sizes) / sizeof(*sizes); s++)
+            ok = checkFlip16(sizes[s][0], sizes[s][1]) && ok;
+    printf("%-8s %s\n", "flip16", ok ? "passed" : "FAILED");
+    if (!ok)
+        failed++;
+    return failed || !tested;
+}
@@ -0,0 +1,44 @@
+# ******************************************************************************
+# pixel_convert_test.pro                                           Tao3D project
+# ******************************************************************************
+#
+# File description:
+# Qt build file for the test of the pixel conversion kernels
+# Build and run with:
+#   qmake && make && ./pixel_convert_test
+#
+#
+#
+#
+#
+# ******************************************************************************
+# This software is licensed under the GNU General Public License v3
+# (C) 2026, agent <agent@local>
+# ******************************************************************************
+# This file is part of Tao3D
+#
+# Tao3D is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Tao3D is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Tao3D, in a file named COPYING.
+# If not, see <https://www.gnu.org/licenses/>.
+# ******************************************************************************
+
+TEMPLATE     = app
+TARGET       = pixel_convert_test
+CONFIG      += console
+CONFIG      -= app_bundle
+QT          -= gui
+
+INCLUDEPATH += ../..
+HEADERS      = ../../vlc_pixel_convert.h
+SOURCES      = pixel_convert_test.cpp \
+               ../../vlc_pixel_convert.cpp
@@ -40,6 +40,7 @@
 #include "tao/tao_gl.h"
 #include "vlc_audio_video.h"
 #include "vlc_video_surface.h"
+#include "vlc_thumbnails.h"
 #include <vlc_video_fullscreen.h>
 #include "vlc_preferences.h"
 #include "action.h"
@@ -50,6 +51,7 @@
 #include <QStringList>
 #include <QVector>
 #include <QTime>
+#include <float.h>
 #ifdef Q_OS_WIN32
 #include <QProcess>
 #endif
@@ -77,6 +79,7 @@ using namespace XL;
 
 const Tao::ModuleApi * VlcAudioVideo::tao = NULL;
 VlcAudioVideo::video_map VlcAudioVideo::videos;
+VlcAudioVideo::thumbnail_map VlcAudioVideo::thumbnails;
 #ifdef Q_OS_WIN32
 text VlcAudioVideo::modulePath;
 #endif
@@ -97,6 +100,26 @@ std::ostream & VlcAudioVideo::sdebug()
 }
 
 
+void VlcAudioVideo::refreshOnWakeUp()
+// ----------------------------------------------------------------------------
+//   Redraw when a video gets a new frame or changes state
+// ----------------------------------------------------------------------------
+//   Videos post events to the widget being drawn, see VlcVideoBase::wakeUp().
+//   A paused or ended video then costs no redraw.
+{
+    const QGLContext *context = QGLContext::currentContext();
+    QObject *widget = context ? dynamic_cast<QObject *>(context->device())
+                              : NULL;
+    if (!widget)
+    {
+        tao->refreshOn(QEvent::Timer, -1.0);
+        return;
+    }
+    VlcVideoBase::setWakeUpTarget(widget);
+    tao->refreshOn(VlcVideoBase::wakeUpEvent(), DBL_MAX);
+}
+
+
 VlcVideoBase *VlcAudioVideo::surface(text name)
 // ----------------------------------------------------------------------------
 //   Return the video surface associated with a given name or NULL
@@ -443,40 +466,45 @@ XL::Integer_p VlcAudioVideo::movie_texture(XL::Context_p context,
         double ttime = tao->currentPageTime();
         double itime = surface->lastTime +
                        surface->lastRate * (ttime-surface->lastTime);
-        QTime t0;
-        const int TIMEOUT = 2000;
-        t0.start();
-        surface->setTime(itime);
 
-        IFTRACE(video)
-            sdebug() << "Seeking at " << t0.elapsed()
-                     << " movie " << surface->time()
-                     << " target " << itime
-                     << " texture " << surface->texture()
-                     << "\n";
-
-        while (surface->texture() == 0      &&
-               surface->lastError == ""     &&
-               t0.elapsed() < TIMEOUT)
-            surface->exec();
-        IFTRACE(video)
-            sdebug() << "Texture at " << t0.elapsed()
-                     << " stime " << surface->time()
-                     << " itime " << itime
-                     << " tex " << surface->texture()
-                     << "\n";
+        // Frames follow page time: wait for the frame, seek if needed
+        if (!surface->stepTo(itime))
+        {
+            QTime t0;
+            const int TIMEOUT = 2000;
+            t0.start();
+            surface->setTime(itime);
 
-        while (surface->time() < itime &&
-               surface->lastError == ""     &&
-               t0.elapsed() < TIMEOUT)
-            surface->exec();
+            IFTRACE(video)
+                sdebug() << "Seeking at " << t0.elapsed()
+                         << " movie " << surface->time()
+                         << " target " << itime
+                         << " texture " << surface->texture()
+                         << "\n";
+
+            while (surface->texture() == 0      &&
+                   surface->lastError == ""     &&
+                   t0.elapsed() < TIMEOUT)
+                surface->exec();
+            IFTRACE(video)
+                sdebug() << "Texture at " << t0.elapsed()
+                         << " stime " << surface->time()
+                         << " itime " << itime
+                         << " tex " << surface->texture()
+                         << "\n";
 
-        IFTRACE(video)
-            sdebug() << "Result  at " << t0.elapsed()
-                     << " stime " << surface->time()
-                     << " itime " << itime
-                     << " tex " << surface->texture()
-                     << "\n";
+            while (surface->time() < itime &&
+                   surface->lastError == ""     &&
+                   t0.elapsed() < TIMEOUT)
+                surface->exec();
+
+            IFTRACE(video)
+                sdebug() << "Result  at " << t0.elapsed()
+                         << " stime " << surface->time()
+                         << " itime " << itime
+                         << " tex " << surface->texture()
+                         << "\n";
+        }
     }
     else
     {
@@ -510,7 +538,7 @@ XL::Integer_p VlcAudioVideo::movie_texture(XL::Context_p context,
     GL.BindTexture(GL_TEXTURE_2D, id);
     GL.TextureSize(w, h);
 
-    tao->refreshOn(QEvent::Timer, -1.0);
+    refreshOnWakeUp();
     return new Integer(id, self->Position());
 }
 
@@ -543,6 +571,25 @@ XL::Integer_p VlcAudioVideo::movie_texture_relative(XL::Context_p context,
 }
 
 
+XL::Integer_p VlcAudioVideo::movie_texture_region(XL::Context_p context,
+                                                 XL::Tree_p self, text name,
+                                                 float x, float y,
+                                                 float w, float h)
+// ----------------------------------------------------------------------------
+//   Make a video player texture showing only a rectangle of the video
+// ----------------------------------------------------------------------------
+{
+    // Set the region before texture size is given to Tao, if we can
+    bool existing = surface(name) != NULL;
+    if (existing)
+        movie_set_region(name, x, y, w, h);
+    XL::Integer_p result = movie_texture(context, self, name);
+    if (!existing)
+        movie_set_region(name, x, y, w, h);
+    return result;
+}
+
+
 XL::Name_p VlcAudioVideo::movie_fullscreen(XL::Context_p context,
                                            XL::Tree_p self, text name)
 // ----------------------------------------------------------------------------
@@ -586,6 +633,7 @@ XL::Name_p VlcAudioVideo::movie_drop(text name)
         VlcVideoBase *s = (*found).second;
         videos.erase(found);
         delete s;
+        dropThumbnails(name);
         return XL::xl_true;
     }
     return XL::xl_false;
@@ -603,6 +651,7 @@ XL::Name_p VlcAudioVideo::movie_only(text name)
         if (name != (*v).first)
         {
             VlcVideoBase *s = (*v).second;
+            dropThumbnails((*v).first);
             videos.erase(v);
             delete s;
             n = videos.begin();
@@ -644,17 +693,45 @@ XL::Real_p VlcAudioVideo::movie_##id(XL::Tree_p self, text name) \
 }
 
 MOVIE_FLOAT_ADAPTER(volume,   )
-MOVIE_FLOAT_ADAPTER(position, tao->refreshOn(QEvent::Timer, -1))
-MOVIE_FLOAT_ADAPTER(time,     tao->refreshOn(QEvent::Timer, -1))
+MOVIE_FLOAT_ADAPTER(position, refreshOnWakeUp())
+MOVIE_FLOAT_ADAPTER(time,     refreshOnWakeUp())
 MOVIE_FLOAT_ADAPTER(length,   )
 MOVIE_FLOAT_ADAPTER(rate ,    )
+MOVIE_FLOAT_ADAPTER(fps,      refreshOnWakeUp())
+
+
+XL::Real_p VlcAudioVideo::movie_sync_offset(XL::Tree_p self, text name)
+// ----------------------------------------------------------------------------
+//   How far a video is ahead of the clock of its sync group, in seconds
+// ----------------------------------------------------------------------------
+{
+    float result = 0.0;
+    refreshOnWakeUp();
+    if (VlcVideoBase *s = surface(name))
+        result = s->syncOffset();
+    return new XL::Real(result, self->Position());
+}
+
+
+XL::Real_p VlcAudioVideo::movie_upload_time(XL::Tree_p self, text name)
+// ----------------------------------------------------------------------------
+//   Average time to convert and upload a frame of the video, in us
+// ----------------------------------------------------------------------------
+{
+    float result = -1.0;
+    VlcVideoSurface *sf = dynamic_cast<VlcVideoSurface *>(surface(name));
+    if (sf)
+        result = sf->uploadTime();
+    return new XL::Real(result, self->Position());
+}
+
 
 #define MOVIE_BOOL_ADAPTER(id)                  \
 XL::Name_p VlcAudioVideo::movie_##id(text name) \
 {                                               \
     QList<VlcVideoBase *>list = surfaces(name); \
     bool ok = !list.isEmpty();                  \
-    tao->refreshOn(QEvent::Timer, -1);          \
+    refreshOnWakeUp();                          \
     foreach (VlcVideoBase *s, surfaces(name))   \
         ok &= s->id();                          \
     return ok ? XL::xl_true : XL::xl_false;     \
@@ -712,6 +789,146 @@ XL::Name_p VlcAudioVideo::movie_set_video_stream(text name, int num)
     return (st == 1) ? XL::xl_true : XL::xl_false;
 }
 
+
+XL::Name_p VlcAudioVideo::movie_set_region(text name,
+                                           float x, float y, float w, float h)
+// ----------------------------------------------------------------------------
+//   Select the rectangle of the video shown by movie textures
+// ----------------------------------------------------------------------------
+{
+    bool ok = false;
+    foreach (VlcVideoBase *s, surfaces(name))
+    {
+        if (VlcVideoSurface *sf = dynamic_cast<VlcVideoSurface *>(s))
+        {
+            sf->setRegion(x, y, w, h);
+            ok = true;
+        }
+    }
+    return ok ? XL::xl_true : XL::xl_false;
+}
+
+
+XL::Name_p VlcAudioVideo::movie_set_gpu_scaling(text name, bool on)
+// ----------------------------------------------------------------------------
+//   Choose if textures of a given size are scaled by the GPU or by libVLC
+// ----------------------------------------------------------------------------
+{
+    bool ok = false;
+    foreach (VlcVideoBase *s, surfaces(name))
+    {
+        if (VlcVideoSurface *sf = dynamic_cast<VlcVideoSurface *>(s))
+        {
+            sf->setGpuScaling(on);
+            ok = true;
+        }
+    }
+    return ok ? XL::xl_true : XL::xl_false;
+}
+
+
+XL::Name_p VlcAudioVideo::movie_cache_loop(text name, int megabytes)
+// ----------------------------------------------------------------------------
+//   Replay the frames of the first pass of a looping video from memory
+// ----------------------------------------------------------------------------
+{
+    bool ok = false;
+    foreach (VlcVideoBase *s, surfaces(name))
+    {
+        if (VlcVideoSurface *sf = dynamic_cast<VlcVideoSurface *>(s))
+        {
+            sf->setLoopCache(qMax(megabytes, 0));
+            ok = true;
+        }
+    }
+    return ok ? XL::xl_true : XL::xl_false;
+}
+
+
+XL::Name_p VlcAudioVideo::movie_sync_group(text group, text name)
+// ----------------------------------------------------------------------------
+//   Make videos follow the clock of a group, or leave it if group is ""
+// ----------------------------------------------------------------------------
+{
+    bool ok = false;
+    foreach (VlcVideoBase *s, surfaces(name))
+    {
+        s->setSyncGroup(+group);
+        ok = true;
+    }
+    return ok ? XL::xl_true : XL::xl_false;
+}
+
+
+XL::Name_p VlcAudioVideo::movie_seek_frame(text name, int frame)
+// ----------------------------------------------------------------------------
+//   Pause videos on the given frame, counted from 0
+// ----------------------------------------------------------------------------
+{
+    QList<VlcVideoBase *> list = surfaces(name);
+    bool ok = !list.isEmpty() && frame >= 0;
+    foreach (VlcVideoBase *s, list)
+        ok &= s->seekFrame(frame);
+    return ok ? XL::xl_true : XL::xl_false;
+}
+
+
+XL::Integer_p VlcAudioVideo::movie_thumbnails(XL::Tree_p self, text name,
+                                              int count, int width)
+// ----------------------------------------------------------------------------
+//   Bind a texture with thumbnails of the movie, decoded in the background
+// ----------------------------------------------------------------------------
+{
+    VlcVideoBase *s = surface(name);
+    libvlc_instance_t *instance = vlcInstance();
+    if (!s || !instance || count <= 0 || width <= 0)
+        return new Integer(0, self->Position());
+    if (count > VlcThumbnails::MAX_COUNT)
+        count = VlcThumbnails::MAX_COUNT;
+    if (width > VlcThumbnails::MAX_WIDTH)
+        width = VlcThumbnails::MAX_WIDTH;
+
+    VlcThumbnails *&strip = thumbnails[name];
+    if (strip && !strip->matches(s->url(), count, width))
+    {
+        strip->drop();
+        strip = NULL;
+    }
+    if (!strip)
+        strip = new VlcThumbnails(instance, s->url(), count, width);
+
+    unsigned w = 0, h = 0;
+    GLuint id = strip->texture(&w, &h);
+    GL.Enable(GL_TEXTURE_2D);
+    GL.BindTexture(GL_TEXTURE_2D, id);
+    GL.TextureSize(w, h);
+
+    if (!strip->complete())
+        refreshOnWakeUp();
+    return new Integer(id, self->Position());
+}
+
+
+void VlcAudioVideo::dropThumbnails(text name)
+// ----------------------------------------------------------------------------
+//   Release the thumbnails of the given movie, or of all movies if empty
+// ----------------------------------------------------------------------------
+{
+    thumbnail_map::iterator t = thumbnails.begin();
+    while (t != thumbnails.end())
+    {
+        if (name == "" || name == (*t).first)
+        {
+            (*t).second->drop();
+            thumbnails.erase(t++);
+        }
+        else
+        {
+            ++t;
+        }
+    }
+}
+
 XL_DEFINE_TRACES
 
 int module_init(const Tao::ModuleApi *api, const Tao::ModuleInfo *mod)
@@ -736,6 +953,9 @@ int module_exit()
 {
     VlcAudioVideo::movie_only("");
     AsyncSetVolume::stop();
+    VideoUploader::stop();
+    VlcAudioVideo::dropThumbnails("");
+    VlcThumbnails::stop();
     VlcAudioVideo::deleteVlcInstance();
     return 0;
 }
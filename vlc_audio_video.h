@@ -48,6 +48,7 @@
 
 
 struct VlcVideoBase;
+struct VlcThumbnails;
 
 
 struct VlcAudioVideo
@@ -56,6 +57,7 @@ struct VlcAudioVideo
 // ----------------------------------------------------------------------------
 {
     typedef std::map<text, VlcVideoBase *>  video_map;
+    typedef std::map<text, VlcThumbnails *> thumbnail_map;
 
 public:
     static libvlc_instance_t *  vlcInstance();
@@ -84,6 +86,11 @@ public:
                                               text name,
                                               float wscale,
                                               float hscale);
+    static XL::Integer_p        movie_texture_region(XL::Context_p context,
+                                                     XL::Tree_p self,
+                                                     text name,
+                                                     float x, float y,
+                                                     float w, float h);
     static XL::Name_p           movie_fullscreen(XL::Context_p context,
                                                  XL::Tree_p self,
                                                  text name);
@@ -99,6 +106,11 @@ public:
     static XL::Real_p           movie_time(XL::Tree_p self, text name);
     static XL::Real_p           movie_length(XL::Tree_p self, text name);
     static XL::Real_p           movie_rate(XL::Tree_p self, text name);
+    static XL::Real_p           movie_fps(XL::Tree_p self, text name);
+    static XL::Real_p           movie_sync_offset(XL::Tree_p self,
+                                                  text name);
+    static XL::Real_p           movie_upload_time(XL::Tree_p self,
+                                                  text name);
 
 
     static XL::Name_p           movie_playing(text name);
@@ -112,6 +124,16 @@ public:
     static XL::Name_p           movie_set_rate(text name, float rate);
     static XL::Name_p           movie_set_loop(text name, bool on);
     static XL::Name_p           movie_set_video_stream(text name, int num);
+    static XL::Name_p           movie_set_region(text name,
+                                                 float x, float y,
+                                                 float w, float h);
+    static XL::Name_p           movie_set_gpu_scaling(text name, bool on);
+    static XL::Name_p           movie_cache_loop(text name, int megabytes);
+    static XL::Name_p           movie_sync_group(text group, text name);
+    static XL::Name_p           movie_seek_frame(text name, int frame);
+    static XL::Integer_p        movie_thumbnails(XL::Tree_p self, text name,
+                                                 int count, int width);
+    static void                 dropThumbnails(text name);
 
 protected:
     struct VlcCleanup
@@ -127,6 +149,7 @@ protected:
     static VlcVideoBase *       surface(text name);
     static QList<VlcVideoBase*> surfaces(text name);
     static std::ostream &       sdebug();
+    static void                 refreshOnWakeUp();
 #ifdef USE_LICENSE
     static bool                 licenseOk();
 #endif
@@ -149,6 +172,7 @@ protected:
 
 public:
     static video_map            videos;
+    static thumbnail_map        thumbnails;
     static const Tao::ModuleApi*tao;
 #ifdef Q_OS_WIN32
     static text                 modulePath;
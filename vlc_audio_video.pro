@@ -90,12 +90,22 @@ isEmpty(VLC_FOUND)|isEmpty(VLC_VERSION_OK) {
   include(../modules.pri)
 
   HEADERS     = vlc_audio_video.h \
+                vlc_frame_cache.h \
+                vlc_frame_pool.h \
+                vlc_media_index.h \
+                vlc_pixel_convert.h \
                 vlc_preferences.h \
+                vlc_thumbnails.h \
                 vlc_video_base.h \
                 vlc_video_fullscreen.h \
                 vlc_video_surface.h
   SOURCES     = vlc_audio_video.cpp \
+                vlc_frame_cache.cpp \
+                vlc_frame_pool.cpp \
+                vlc_media_index.cpp \
+                vlc_pixel_convert.cpp \
                 vlc_preferences.cpp \
+                vlc_thumbnails.cpp \
                 vlc_video_base.cpp \
                 vlc_video_fullscreen.cpp \
                 vlc_video_surface.cpp
@@ -0,0 +1,222 @@
+// *****************************************************************************
+// vlc_frame_cache.cpp                                             Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Record the frames of the first pass of a looping video, so that the
+//    following passes are replayed without decoding.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2026, agent <agent@local>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include "vlc_frame_cache.h"
+#include "vlc_frame_pool.h"
+#include "base.h"  // IFTRACE()
+#include <QMutexLocker>
+#include <QTemporaryFile>
+#include <QDir>
+#include <string.h>
+#include <iostream>
+#ifndef Q_OS_WIN32
+#include <sys/mman.h>
+#endif
+
+
+FrameCache::FrameCache(size_t limit)
+// ----------------------------------------------------------------------------
+//   Create an empty cache. Memory is allocated with the first frame
+// ----------------------------------------------------------------------------
+    : limit(limit), base(NULL), mapped(false), spill(NULL), size(0),
+      length(0), done(false), abandoned(false)
+{}
+
+
+FrameCache::~FrameCache()
+// ----------------------------------------------------------------------------
+//   Release the frames
+// ----------------------------------------------------------------------------
+{
+    release();
+}
+
+
+bool FrameCache::record(const void *frame, unsigned frameSize)
+// ----------------------------------------------------------------------------
+//   Append a copy of frame, return false if the cache does not record
+// ----------------------------------------------------------------------------
+{
+    QMutexLocker locker(&mutex);
+    if (done || abandoned)
+        return false;
+
+    if (!base)
+    {
+        size = frameSize;
+        if (!allocate())
+            return false;
+        clock.start();
+    }
+    if (frameSize != size)
+    {
+        abandon("frame size changed");
+        return false;
+    }
+    if (bytes() + size > limit)
+    {
+        abandon("frames do not fit in the cache");
+        return false;
+    }
+
+    memcpy(base + bytes(), frame, size);
+    times.append(clock.elapsed());
+    return true;
+}
+
+
+bool FrameCache::finish()
+// ----------------------------------------------------------------------------
+//   End of the first pass: return true if all its frames were recorded
+// ----------------------------------------------------------------------------
+{
+    QMutexLocker locker(&mutex);
+    if (!done && !abandoned)
+    {
+        done = true;
+        if (times.size() < 2)
+        {
+            abandon("less than two frames");
+        }
+        else
+        {
+            // The last frame is shown as long as the average frame
+            qint64 last = times.last();
+            length = last + last / (times.size() - 1);
+            IFTRACE(video)
+                std::cerr << "[FrameCache " << (void *) this << "] "
+                          << times.size() << " frames, " << bytes() / 1024
+                          << " KB " << (spill ? "in a file" : "in memory")
+                          << ", loop of " << length << " ms\n";
+        }
+    }
+    return complete();
+}
+
+
+int FrameCache::frameAt(qint64 ms)
+// ----------------------------------------------------------------------------
+//   Index of the frame to show 'ms' milliseconds after the start of a pass
+// ----------------------------------------------------------------------------
+//   Times beyond one pass wrap around. Times are sorted, so bisect.
+{
+    if (!complete())
+        return -1;
+    ms %= length;
+    int lo = 0, hi = times.size() - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (times[mid] <= ms)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+
+bool FrameCache::allocate()
+// ----------------------------------------------------------------------------
+//   Reserve 'limit' bytes. Pages are only committed as frames are written
+// ----------------------------------------------------------------------------
+//   Huge pages are not used here: MAP_HUGETLB would take the whole limit
+//   from the reserved huge pages up front, for a pass that may be short.
+{
+    if (limit > MAX_MEMORY)
+    {
+        spill = new QTemporaryFile(QDir::tempPath() + "/tao_vlc_cache");
+        if (spill->open() && spill->resize(limit))
+            base = (char *) spill->map(0, limit);
+        if (!base)
+        {
+            delete spill;
+            spill = NULL;
+        }
+    }
+#ifndef Q_OS_WIN32
+    if (!base)
+    {
+        void *p = mmap(NULL, limit, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (p != MAP_FAILED)
+        {
+            base = (char *) p;
+            mapped = true;
+        }
+    }
+#endif
+    if (!base)
+    {
+        mapped = false;
+        base = (char *) FramePool::allocate(limit, &mapped);
+    }
+    if (!base)
+        abandon("out of memory");
+    return base != NULL;
+}
+
+
+void FrameCache::release()
+// ----------------------------------------------------------------------------
+//   Release the memory or the temporary file of the frames
+// ----------------------------------------------------------------------------
+{
+    if (spill)
+    {
+        spill->unmap((uchar *) base);
+        delete spill;           // Removes the file
+        spill = NULL;
+    }
+    else if (base)
+    {
+        FramePool::deallocate(base, limit, mapped);
+    }
+    base = NULL;
+}
+
+
+void FrameCache::abandon(const char *reason)
+// ----------------------------------------------------------------------------
+//   Stop recording, and release frames recorded so far
+// ----------------------------------------------------------------------------
+{
+    IFTRACE(video)
+        std::cerr << "[FrameCache " << (void *) this << "] "
+                  << "Not caching the loop: " << reason << "\n";
+    abandoned = true;
+    release();
+    times.clear();
+}
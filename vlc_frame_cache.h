@@ -0,0 +1,97 @@
+#ifndef VLC_FRAME_CACHE_H
+#define VLC_FRAME_CACHE_H
+// *****************************************************************************
+// vlc_frame_cache.h                                               Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Record the frames of the first pass of a looping video, so that the
+//    following passes are replayed without decoding.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2026, agent <agent@local>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QVector>
+#include <stddef.h>
+
+class QTemporaryFile;
+
+
+struct FrameCache
+// ----------------------------------------------------------------------------
+//   Frames of one pass of a video, with the time they were shown at
+// ----------------------------------------------------------------------------
+//   record() is called from the libVLC thread during the first pass, and
+//   finish() from the main thread when the pass ends. After that, frames
+//   are only read. Recording is abandoned if the frames do not fit in
+//   'limit' bytes or if their size changes.
+//   Frames are stored in memory, or in a memory-mapped temporary file if
+//   'limit' is larger than MAX_MEMORY.
+{
+public:
+    enum { MAX_MEMORY = 256 * 1024 * 1024 };
+
+public:
+    FrameCache(size_t limit);
+    ~FrameCache();
+
+public:
+    bool           record(const void *frame, unsigned size);
+    bool           finish();
+    int            frameAt(qint64 ms);
+    const void *   frame(int index)  { return base + size_t(index) * size; }
+
+public:
+    bool           complete()   { return done && !abandoned; }
+    unsigned       count()      { return times.size(); }
+    unsigned       frameSize()  { return size; }
+    qint64         duration()   { return length; }
+    size_t         bytes()      { return size_t(count()) * size; }
+    bool           spilled()    { return spill != NULL; }
+
+protected:
+    bool           allocate();
+    void           release();
+    void           abandon(const char *reason);
+
+protected:
+    QMutex                  mutex;
+    size_t                  limit;
+    char *                  base;
+    bool                    mapped;    // Memory allocated with mmap()
+    QTemporaryFile *        spill;     // File mapped at 'base', or NULL
+    unsigned                size;      // Size of all frames
+    QVector<qint64>         times;     // When each frame was shown, in ms
+    QElapsedTimer           clock;     // Started with the first frame
+    qint64                  length;    // Duration of one pass, in ms
+    bool                    done;
+    bool                    abandoned;
+};
+
+#endif // VLC_FRAME_CACHE_H
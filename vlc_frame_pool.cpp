@@ -0,0 +1,373 @@
+// *****************************************************************************
+// vlc_frame_pool.cpp                                              Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Pre-allocated pool of video frames handed out to libVLC by the vmem
+//    lock callback, so that steady-state playback does no heap allocation.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2026, agent <agent@local>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include "vlc_frame_pool.h"
+#include "base.h"  // IFTRACE(), XL_ASSERT()
+#include <QtGlobal>
+#include <QThread>
+#include <new>
+#include <stdlib.h>
+#include <iostream>
+#ifdef Q_OS_WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+#ifdef Q_OS_MACX
+#include <mach/vm_statistics.h>
+#endif
+
+
+static const size_t HUGE_PAGE = 2 * 1024 * 1024;
+
+
+FramePool::FramePool()
+// ----------------------------------------------------------------------------
+//   Create an empty pool. Slots are allocated by configure()
+// ----------------------------------------------------------------------------
+    : size(0), current(NULL), readers(0), retired(NULL), hint(0),
+      hitCount(0), missCount(0), inUseCount(0), highWaterMark(0)
+{}
+
+
+FramePool::~FramePool()
+// ----------------------------------------------------------------------------
+//   Release all slabs. Frames still held by libVLC are not valid anymore
+// ----------------------------------------------------------------------------
+{
+    delete current.load();
+    Slab *s = retired;
+    while (s)
+    {
+        Slab *next = s->next;
+        delete s;
+        s = next;
+    }
+}
+
+
+void FramePool::configure(unsigned frameSize, unsigned count)
+// ----------------------------------------------------------------------------
+//   Pre-allocate 'count' frames of 'frameSize' bytes
+// ----------------------------------------------------------------------------
+//   A slab that is already large enough is kept. Otherwise the current slab
+//   is retired (not freed right away) because frames from it may be in use.
+//   With a count of 0, no slab is allocated: frames come from the heap until
+//   adopt() gives the pool its memory.
+{
+    size.storeRelease(frameSize);
+
+    Slab *old = current.load();
+    if (old && old->stride >= frameSize && old->count >= count)
+        return;
+
+    Slab *slab = count ? new Slab(stride(frameSize), count) : NULL;
+    if (slab && !slab->base)
+    {
+        delete slab;
+        slab = NULL;
+    }
+    install(slab);
+}
+
+
+void FramePool::adopt(void *base, unsigned stride, unsigned count)
+// ----------------------------------------------------------------------------
+//   Hand out frames from externally owned memory, e.g. a mapped GL buffer
+// ----------------------------------------------------------------------------
+//   The memory must remain valid as long as the pool exists.
+{
+    XL_ASSERT(stride >= unsigned(size.load()));
+    install(new Slab(stride, count, base));
+}
+
+
+void FramePool::install(Slab *slab)
+// ----------------------------------------------------------------------------
+//   Make slab the current one, and retire the previous one
+// ----------------------------------------------------------------------------
+{
+    Slab *old = current.fetchAndStoreOrdered(slab);
+    if (old)
+    {
+        QMutexLocker locker(&mutex);
+        old->next = retired;
+        retired = old;
+        sweep();
+    }
+}
+
+
+void FramePool::sweep()
+// ----------------------------------------------------------------------------
+//   Free the retired slabs with no frame in use. Called with 'mutex' locked
+// ----------------------------------------------------------------------------
+//   acquire(), release() and index() count themselves in 'readers' before
+//   loading 'current', so they may still hold a slab that was just retired.
+//   They only look at it for a few instructions and never take 'mutex', so
+//   wait for them rather than leave an idle slab until the next release().
+{
+    while (readers.loadAcquire())
+        QThread::yieldCurrentThread();
+
+    Slab **link = &retired;
+    while (Slab *s = *link)
+    {
+        if (s->idle())
+        {
+            *link = s->next;
+            delete s;
+        }
+        else
+        {
+            link = &s->next;
+        }
+    }
+}
+
+
+void *FramePool::acquire()
+// ----------------------------------------------------------------------------
+//   Return a free frame, from the slab if possible, else from the heap
+// ----------------------------------------------------------------------------
+{
+    unsigned bytes = size.loadAcquire();
+    XL_ASSERT(bytes);
+
+    void *found = NULL;
+    readers.fetchAndAddOrdered(1);
+    if (Slab *s = current.loadAcquire())
+    {
+        unsigned start = hint.fetchAndAddRelaxed(1);
+        for (unsigned i = 0; i < s->count && !found; i++)
+        {
+            unsigned k = (start + i) % s->count;
+            if (s->used[k].testAndSetAcquire(0, 1))
+                found = s->base + k * s->stride;
+        }
+    }
+    readers.fetchAndAddOrdered(-1);
+    if (found)
+    {
+        hitCount.fetchAndAddRelaxed(1);
+        noteAcquired();
+        return found;
+    }
+
+    // All slots are busy: fall back to the heap
+    bool mapped = false;
+    void *frame = allocate(bytes, &mapped);
+    if (!frame)
+        throw std::bad_alloc();
+    missCount.fetchAndAddRelaxed(1);
+    noteAcquired();
+    return frame;
+}
+
+
+void FramePool::release(void *frame)
+// ----------------------------------------------------------------------------
+//   Give a frame back to its slab, or to the heap if it did not come from one
+// ----------------------------------------------------------------------------
+{
+    if (!frame)
+        return;
+
+    inUseCount.fetchAndAddRelaxed(-1);
+
+    bool done = false;
+    readers.fetchAndAddOrdered(1);
+    Slab *s = current.loadAcquire();
+    if (s && s->contains(frame))
+    {
+        unsigned k = ((char *) frame - s->base) / s->stride;
+        s->used[k].storeRelease(0);
+        done = true;
+    }
+    readers.fetchAndAddOrdered(-1);
+    if (done)
+        return;
+
+    // Frame from a retired slab, which may be freed now, or from the heap
+    QMutexLocker locker(&mutex);
+    for (s = retired; s; s = s->next)
+    {
+        if (s->contains(frame))
+        {
+            unsigned k = ((char *) frame - s->base) / s->stride;
+            s->used[k].storeRelease(0);
+            sweep();
+            return;
+        }
+    }
+    locker.unlock();
+
+    deallocate(frame, size.load(), false);
+}
+
+
+int FramePool::index(void *frame)
+// ----------------------------------------------------------------------------
+//   Return the slot of frame in the current slab, or -1
+// ----------------------------------------------------------------------------
+{
+    int k = -1;
+    readers.fetchAndAddOrdered(1);
+    Slab *s = current.loadAcquire();
+    if (s && s->contains(frame))
+        k = ((char *) frame - s->base) / s->stride;
+    readers.fetchAndAddOrdered(-1);
+    return k;
+}
+
+
+void FramePool::noteAcquired()
+// ----------------------------------------------------------------------------
+//   Update the count of frames in use and its high-water mark
+// ----------------------------------------------------------------------------
+{
+    int n = inUseCount.fetchAndAddRelaxed(1) + 1;
+    int hw = highWaterMark.load();
+    while (n > hw && !highWaterMark.testAndSetRelaxed(hw, n))
+        hw = highWaterMark.load();
+}
+
+
+void *FramePool::allocate(size_t bytes, bool *mapped)
+// ----------------------------------------------------------------------------
+//   Allocate cache-line aligned memory, backed by huge pages if requested
+// ----------------------------------------------------------------------------
+//   'mapped' is an input/output parameter: on input, it tells if we want
+//   huge pages, on output, if the memory comes from mmap().
+{
+#ifndef Q_OS_WIN32
+    if (*mapped)
+    {
+        void *p = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANON | MAP_HUGETLB, -1, 0);
+#elif defined(VM_FLAGS_SUPERPAGE_SIZE_ANY)
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANON, VM_FLAGS_SUPERPAGE_SIZE_ANY, 0);
+#endif
+        if (p == MAP_FAILED)
+        {
+            // No reserved huge pages: ask for transparent huge pages instead
+            p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANON, -1, 0);
+#if defined(MADV_HUGEPAGE)
+            if (p != MAP_FAILED)
+                madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+        }
+        if (p != MAP_FAILED)
+            return p;
+    }
+#endif
+
+    *mapped = false;
+#ifdef Q_OS_WIN32
+    return __mingw_aligned_malloc(bytes, CACHE_LINE);
+#else
+    void *p = NULL;
+    if (posix_memalign(&p, CACHE_LINE, bytes))
+        return NULL;
+    return p;
+#endif
+}
+
+
+void FramePool::deallocate(void *ptr, size_t bytes, bool mapped)
+// ----------------------------------------------------------------------------
+//   Release memory obtained from allocate()
+// ----------------------------------------------------------------------------
+{
+#ifdef Q_OS_WIN32
+    Q_UNUSED(bytes);
+    Q_UNUSED(mapped);
+    __mingw_aligned_free(ptr);
+#else
+    if (mapped)
+        munmap(ptr, bytes);
+    else
+        free(ptr);
+#endif
+}
+
+
+FramePool::Slab::Slab(unsigned stride, unsigned count, void *external)
+// ----------------------------------------------------------------------------
+//   Allocate 'count' slots of 'stride' bytes in a single block
+// ----------------------------------------------------------------------------
+    : base((char *) external), bytes(size_t(stride) * count),
+      stride(stride), count(count),
+      used(new QAtomicInt[count]), mapped(true), external(external != NULL),
+      next(NULL)
+{
+    if (!external)
+    {
+        bytes = (bytes + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+        base = (char *) FramePool::allocate(bytes, &mapped);
+    }
+    IFTRACE(video)
+        std::cerr << "[FramePool] " << count << " frames of " << stride
+                  << " bytes at " << (void *) base
+                  << (external ? " (external)" :
+                      mapped   ? " (mapped)"   : " (heap)") << "\n";
+}
+
+
+FramePool::Slab::~Slab()
+// ----------------------------------------------------------------------------
+//   Release slab memory
+// ----------------------------------------------------------------------------
+{
+    if (base && !external)
+        FramePool::deallocate(base, bytes, mapped);
+    delete[] used;
+}
+
+
+bool FramePool::Slab::idle()
+// ----------------------------------------------------------------------------
+//   Return true if no frame of the slab is in use
+// ----------------------------------------------------------------------------
+{
+    for (unsigned k = 0; k < count; k++)
+        if (used[k].loadAcquire())
+            return false;
+    return true;
+}
@@ -0,0 +1,121 @@
+#ifndef VLC_FRAME_POOL_H
+#define VLC_FRAME_POOL_H
+// *****************************************************************************
+// vlc_frame_pool.h                                                Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Pre-allocated pool of video frames handed out to libVLC by the vmem
+//    lock callback, so that steady-state playback does no heap allocation.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2026, agent <agent@local>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QMutex>
+#include <stddef.h>
+
+
+struct FramePool
+// ----------------------------------------------------------------------------
+//   Fixed ring of cache-line aligned frame buffers with lock-free access
+// ----------------------------------------------------------------------------
+//   acquire() and release() may be called from any thread without locking.
+//   When all slots are in use, acquire() falls back to the heap (a "miss").
+//   configure() is called from the libVLC format callback, before any frame
+//   of the new size is requested. The previous slab is retired, and freed
+//   once all its frames are released and no thread is still looking at it.
+{
+public:
+    enum { DEFAULT_COUNT = 6, CACHE_LINE = 64 };
+
+public:
+    FramePool();
+    ~FramePool();
+
+public:
+    void           configure(unsigned size, unsigned count = DEFAULT_COUNT);
+    void           adopt(void *base, unsigned stride, unsigned count);
+    void *         acquire();
+    void           release(void *frame);
+    int            index(void *frame);
+    static unsigned stride(unsigned size)
+    {
+        return (size + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+    }
+    static void *  allocate(size_t bytes, bool *mapped);
+    static void    deallocate(void *ptr, size_t bytes, bool mapped);
+
+public:
+    unsigned       frameSize()  { return size.load(); }
+    unsigned       hits()       { return hitCount.load(); }
+    unsigned       misses()     { return missCount.load(); }
+    unsigned       inUse()      { return inUseCount.load(); }
+    unsigned       highWater()  { return highWaterMark.load(); }
+
+protected:
+    struct Slab
+    {
+        Slab(unsigned stride, unsigned count, void *external = NULL);
+        ~Slab();
+
+        bool       contains(void *p)
+        {
+            return (char *) p >= base && (char *) p < base + stride * count;
+        }
+        bool       idle();
+
+        char *     base;
+        size_t     bytes;     // Allocated size, including huge page padding
+        unsigned   stride;    // Frame size rounded up to a cache line
+        unsigned   count;
+        QAtomicInt*used;      // One flag per slot
+        bool       mapped;    // Allocated with mmap() vs aligned malloc()
+        bool       external;  // Memory not owned, e.g. a mapped GL buffer
+        Slab *     next;      // Link in list of retired slabs
+    };
+
+protected:
+    void           install(Slab *slab);
+    void           sweep();
+    void           noteAcquired();
+
+protected:
+    QAtomicInt             size;       // Set by configure(), any thread
+    QAtomicPointer<Slab>   current;
+    QAtomicInt             readers;    // Threads using 'current', see sweep()
+    QMutex                 mutex;      // Protects 'retired'
+    Slab *                 retired;    // Slabs from a previous configure()
+    QAtomicInt             hint;       // Where to start looking for a slot
+    QAtomicInt             hitCount;
+    QAtomicInt             missCount;
+    QAtomicInt             inUseCount;
+    QAtomicInt             highWaterMark;
+};
+
+#endif // VLC_FRAME_POOL_H
@@ -0,0 +1,454 @@
+// *****************************************************************************
+// vlc_media_index.cpp                                             Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Index of the frames and keyframes of the video track of a media file,
+//    built once in the background and kept in a sidecar cache file.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2026, agent <agent@local>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include "vlc_media_index.h"
+#include "base.h"  // IFTRACE()
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <algorithm>
+#include <iostream>
+
+
+static inline quint32 be32(const uchar *p)
+// ----------------------------------------------------------------------------
+//   Read a big-endian 32-bit value, as in MP4 boxes
+// ----------------------------------------------------------------------------
+{
+    return (quint32(p[0]) << 24) | (quint32(p[1]) << 16) |
+           (quint32(p[2]) << 8)  |  quint32(p[3]);
+}
+
+
+static inline quint64 be64(const uchar *p)
+// ----------------------------------------------------------------------------
+//   Read a big-endian 64-bit value
+// ----------------------------------------------------------------------------
+{
+    return (quint64(be32(p)) << 32) | be32(p + 4);
+}
+
+
+static inline quint32 fourcc(const char *type)
+// ----------------------------------------------------------------------------
+//   Box type from its name, e.g. "moov"
+// ----------------------------------------------------------------------------
+{
+    return be32((const uchar *) type);
+}
+
+
+static const uchar *nextBox(const uchar *&p, const uchar *end,
+                            quint32 *type, qint64 *size)
+// ----------------------------------------------------------------------------
+//   Return the contents of the box at p and move p after it, NULL at end
+// ----------------------------------------------------------------------------
+{
+    if (end - p < 8)
+        return NULL;
+    qint64 boxSize = be32(p);
+    qint64 header = 8;
+    if (boxSize == 1)
+    {
+        if (end - p < 16)
+            return NULL;
+        boxSize = be64(p + 8);
+        header = 16;
+    }
+    else if (boxSize == 0)
+    {
+        boxSize = end - p;      // Up to the end of the parent
+    }
+    if (boxSize < header || boxSize > end - p)
+        return NULL;
+
+    const uchar *body = p + header;
+    *type = be32(p + 4);
+    *size = boxSize - header;
+    p += boxSize;
+    return body;
+}
+
+
+static const uchar *findBox(const uchar *p, qint64 size, const char *type,
+                            qint64 *bodySize)
+// ----------------------------------------------------------------------------
+//   Return the contents of the first child box of the given type, or NULL
+// ----------------------------------------------------------------------------
+{
+    const uchar *end = p + size;
+    const uchar *body;
+    quint32 t;
+    while ((body = nextBox(p, end, &t, bodySize)))
+        if (t == fourcc(type))
+            return body;
+    return NULL;
+}
+
+
+struct ByTime
+// ----------------------------------------------------------------------------
+//   Order samples by presentation time
+// ----------------------------------------------------------------------------
+{
+    ByTime(const QVector<qint64> &times) : times(times) {}
+    bool operator()(quint32 a, quint32 b) const { return times[a] < times[b]; }
+    const QVector<qint64> &times;
+};
+
+
+
+// ============================================================================
+//
+//   Index of a media file
+//
+// ============================================================================
+
+MediaIndex::MediaIndex(QString path)
+// ----------------------------------------------------------------------------
+//   Create an empty index. References are for the caller and run()
+// ----------------------------------------------------------------------------
+    : path(path), refs(2), status(INDEXING), timescale(0), end(0)
+{
+    setAutoDelete(false);
+}
+
+
+MediaIndex *MediaIndex::start(QString path)
+// ----------------------------------------------------------------------------
+//   Load or build the index of a file in the background
+// ----------------------------------------------------------------------------
+{
+    MediaIndex *index = new MediaIndex(path);
+    QThreadPool::globalInstance()->start(index);
+    return index;
+}
+
+
+double MediaIndex::frameTime(unsigned n)
+// ----------------------------------------------------------------------------
+//   Time when frame n starts, in seconds from the first frame
+// ----------------------------------------------------------------------------
+{
+    return times[n] / double(timescale);
+}
+
+
+double MediaIndex::frameDuration(unsigned n)
+// ----------------------------------------------------------------------------
+//   How long frame n is shown, in seconds
+// ----------------------------------------------------------------------------
+{
+    qint64 next = n + 1 < unsigned(times.size()) ? times[n + 1] : end;
+    return (next - times[n]) / double(timescale);
+}
+
+
+unsigned MediaIndex::keyframe(unsigned n)
+// ----------------------------------------------------------------------------
+//   The last keyframe at or before frame n, from which n can be decoded
+// ----------------------------------------------------------------------------
+{
+    if (keyframes.isEmpty())
+        return n;
+    const quint32 *k = std::upper_bound(keyframes.constBegin(),
+                                        keyframes.constEnd(), n);
+    return k == keyframes.constBegin() ? 0 : k[-1];
+}
+
+
+void MediaIndex::run()
+// ----------------------------------------------------------------------------
+//   Pool thread: read the index from the cache, or scan the file
+// ----------------------------------------------------------------------------
+//   A file that cannot be indexed is recorded as such, so that it is only
+//   scanned once too.
+{
+    bool cached = load();
+    if (!cached)
+    {
+        if (!scan())
+        {
+            timescale = 0;
+            times.clear();
+            keyframes.clear();
+        }
+        save();
+    }
+
+    IFTRACE(video)
+    {
+        std::cerr << "[MediaIndex " << (void *) this << "] "
+                  << path.toUtf8().constData() << ": ";
+        if (timescale)
+            std::cerr << times.size() << " frames, "
+                      << (keyframes.isEmpty() ? times.size()
+                                              : keyframes.size())
+                      << " keyframes";
+        else
+            std::cerr << "not indexed";
+        std::cerr << (cached ? " (cached)\n" : "\n");
+    }
+
+    status.storeRelease(timescale ? READY : FAILED);
+    unref();
+}
+
+
+QString MediaIndex::cachePath()
+// ----------------------------------------------------------------------------
+//   Sidecar file of the index, which changes if the media file changes
+// ----------------------------------------------------------------------------
+{
+    QFileInfo info(path);
+    QString key = info.absoluteFilePath() + "|" +
+                  QString::number(info.size()) + "|" +
+                  QString::number(info.lastModified().toMSecsSinceEpoch());
+    QByteArray hash = QCryptographicHash::hash(key.toUtf8(),
+                                               QCryptographicHash::Sha1);
+    QString dir = QStandardPaths::writableLocation(
+        QStandardPaths::CacheLocation);
+    return dir + "/vlc_index/" + QString::fromLatin1(hash.toHex()) + ".idx";
+}
+
+
+bool MediaIndex::load()
+// ----------------------------------------------------------------------------
+//   Read the index saved by a previous scan, return false if there is none
+// ----------------------------------------------------------------------------
+{
+    QFile file(cachePath());
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    quint32 magic = 0, version = 0;
+    in >> magic >> version;
+    if (magic != CACHE_MAGIC || version != CACHE_VERSION)
+        return false;
+    in >> timescale >> end >> times >> keyframes;
+    return in.status() == QDataStream::Ok;
+}
+
+
+void MediaIndex::save()
+// ----------------------------------------------------------------------------
+//   Write the index to the cache. A truncated file fails to load()
+// ----------------------------------------------------------------------------
+{
+    QString name = cachePath();
+    QDir().mkpath(QFileInfo(name).path());
+    QFile file(name);
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+
+    QDataStream out(&file);
+    out << quint32(CACHE_MAGIC) << quint32(CACHE_VERSION)
+        << timescale << end << times << keyframes;
+}
+
+
+bool MediaIndex::scan()
+// ----------------------------------------------------------------------------
+//   Find the 'moov' box among the top-level boxes, and parse it
+// ----------------------------------------------------------------------------
+//   Only box headers are read until 'moov', which skips the media data.
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    qint64 pos = 0, fileSize = file.size();
+    while (pos + 8 <= fileSize)
+    {
+        uchar header[16];
+        if (!file.seek(pos))
+            return false;
+        qint64 got = file.read((char *) header, sizeof(header));
+        if (got < 8)
+            return false;
+
+        qint64 size = be32(header);
+        qint64 headerSize = 8;
+        if (size == 1)
+        {
+            if (got < 16)
+                return false;
+            size = be64(header + 8);
+            headerSize = 16;
+        }
+        else if (size == 0)
+        {
+            size = fileSize - pos;
+        }
+        if (size < headerSize || size > fileSize - pos)
+            return false;
+
+        if (be32(header + 4) == fourcc("moov"))
+        {
+            qint64 moovSize = size - headerSize;
+            if (moovSize > MAX_MOOV || !file.seek(pos + headerSize))
+                return false;
+            QByteArray moov = file.read(moovSize);
+            return moov.size() == moovSize && parseMovie(moov);
+        }
+        pos += size;
+    }
+    return false;
+}
+
+
+bool MediaIndex::parseMovie(const QByteArray &moov)
+// ----------------------------------------------------------------------------
+//   Index the first video track of the movie
+// ----------------------------------------------------------------------------
+{
+    const uchar *p = (const uchar *) moov.constData();
+    const uchar *end = p + moov.size();
+    const uchar *body;
+    quint32 type;
+    qint64 size;
+    while ((body = nextBox(p, end, &type, &size)))
+        if (type == fourcc("trak") && parseTrack(body, size))
+            return true;
+    return false;
+}
+
+
+bool MediaIndex::parseTrack(const uchar *trak, qint64 size)
+// ----------------------------------------------------------------------------
+//   Index a track from its sample tables, return false if not video
+// ----------------------------------------------------------------------------
+//   Decoding times come from 'stts', presentation offsets (B-frames) from
+//   'ctts', keyframes from 'stss'. Frames are then sorted in display
+//   order, and times start at the first frame shown. Edit lists are left
+//   to libVLC, which applies them when seeking.
+{
+    qint64 mdiaSize, hdlrSize, mdhdSize, minfSize, stblSize;
+    const uchar *mdia = findBox(trak, size, "mdia", &mdiaSize);
+    const uchar *hdlr = mdia ? findBox(mdia, mdiaSize, "hdlr", &hdlrSize)
+                             : NULL;
+    if (!hdlr || hdlrSize < 12 || be32(hdlr + 8) != fourcc("vide"))
+        return false;
+
+    const uchar *mdhd = findBox(mdia, mdiaSize, "mdhd", &mdhdSize);
+    if (!mdhd || mdhdSize < 24)
+        return false;
+    quint32 scale = be32(mdhd + (mdhd[0] == 1 ? 20 : 12));
+    const uchar *minf = findBox(mdia, mdiaSize, "minf", &minfSize);
+    const uchar *stbl = minf ? findBox(minf, minfSize, "stbl", &stblSize)
+                             : NULL;
+    if (!scale || !stbl)
+        return false;
+
+    // Decoding times, from the durations of runs of samples
+    qint64 sttsSize;
+    const uchar *stts = findBox(stbl, stblSize, "stts", &sttsSize);
+    if (!stts || sttsSize < 8)
+        return false;
+    quint32 entries = be32(stts + 4);
+    if (entries > (sttsSize - 8) / 8)
+        return false;
+    QVector<qint64> pts;
+    qint64 t = 0, last = 0;
+    for (quint32 i = 0; i < entries; i++)
+    {
+        const uchar *e = stts + 8 + 8 * i;
+        quint32 count = be32(e);
+        last = be32(e + 4);
+        if (pts.size() + qint64(count) > MAX_FRAMES)
+            return false;
+        for (quint32 k = 0; k < count; k++, t += last)
+            pts.append(t);
+    }
+    unsigned n = pts.size();
+    if (!n)
+        return false;
+
+    // Presentation times. Offsets are signed in practice, whatever version
+    qint64 cttsSize;
+    const uchar *ctts = findBox(stbl, stblSize, "ctts", &cttsSize);
+    if (ctts && cttsSize >= 8)
+    {
+        entries = qMin(qint64(be32(ctts + 4)), (cttsSize - 8) / 8);
+        unsigned s = 0;
+        for (quint32 i = 0; i < entries; i++)
+        {
+            const uchar *e = ctts + 8 + 8 * i;
+            quint32 count = be32(e);
+            qint32 offset = qint32(be32(e + 4));
+            for (quint32 k = 0; k < count && s < n; k++)
+                pts[s++] += offset;
+        }
+    }
+
+    // Display order, and rank of each sample in it
+    QVector<quint32> order(n), rank(n);
+    for (unsigned i = 0; i < n; i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), ByTime(pts));
+    qint64 first = pts[order[0]];
+    times.resize(n);
+    for (unsigned i = 0; i < n; i++)
+    {
+        rank[order[i]] = i;
+        times[i] = pts[order[i]] - first;
+    }
+    end = times[n - 1] + last;
+
+    // Keyframes, numbered from 1. Without 'stss', all frames are keyframes
+    qint64 stssSize;
+    const uchar *stss = findBox(stbl, stblSize, "stss", &stssSize);
+    keyframes.clear();
+    if (stss && stssSize >= 8)
+    {
+        entries = qMin(qint64(be32(stss + 4)), (stssSize - 8) / 4);
+        for (quint32 i = 0; i < entries; i++)
+        {
+            quint32 s = be32(stss + 8 + 4 * i);
+            if (s >= 1 && s <= n)
+                keyframes.append(rank[s - 1]);
+        }
+        std::sort(keyframes.begin(), keyframes.end());
+    }
+    timescale = scale;
+    return true;
+}
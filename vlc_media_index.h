@@ -0,0 +1,95 @@
+#ifndef VLC_MEDIA_INDEX_H
+#define VLC_MEDIA_INDEX_H
+// *****************************************************************************
+// vlc_media_index.h                                               Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Index of the frames and keyframes of the video track of a media file,
+//    built once in the background and kept in a sidecar cache file.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2026, agent <agent@local>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QString>
+#include <QVector>
+
+class QByteArray;
+
+
+struct MediaIndex : QRunnable
+// ----------------------------------------------------------------------------
+//   Start time of each frame of the video track, and which are keyframes
+// ----------------------------------------------------------------------------
+//   The index is built by a thread of QThreadPool from the sample tables
+//   of MP4 and QuickTime files, and saved in the cache directory under a
+//   name derived from the path, size and date of the file. Other formats
+//   are not indexed. Once ready() is true, the index does not change.
+//   The thread holds a reference until it is done, see unref().
+{
+public:
+    enum Status { INDEXING, READY, FAILED };
+    enum { CACHE_MAGIC = 0x54564958, CACHE_VERSION = 1,
+           MAX_MOOV = 64 * 1024 * 1024, MAX_FRAMES = 16 * 1024 * 1024 };
+
+public:
+    static MediaIndex * start(QString path);
+    void           ref()         { refs.ref(); }
+    void           unref()       { if (!refs.deref()) delete this; }
+
+public:
+    bool           ready()       { return status.loadAcquire() == READY; }
+    unsigned       frameCount()  { return times.size(); }
+    double         frameTime(unsigned n);
+    double         frameDuration(unsigned n);
+    unsigned       keyframe(unsigned n);
+
+protected:
+    MediaIndex(QString path);
+    virtual ~MediaIndex() {}
+
+    virtual void   run();
+    QString        cachePath();
+    bool           load();
+    void           save();
+    bool           scan();
+    bool           parseMovie(const QByteArray &moov);
+    bool           parseTrack(const uchar *trak, qint64 size);
+
+protected:
+    QString                 path;
+    QAtomicInt              refs;
+    QAtomicInt              status;
+    quint32                 timescale;  // Units of times per second, 0: none
+    QVector<qint64>         times;      // Frame starts, in display order
+    qint64                  end;        // End of the last frame
+    QVector<quint32>        keyframes;  // Sorted, empty if all frames are
+};
+
+#endif // VLC_MEDIA_INDEX_H
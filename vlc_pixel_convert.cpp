@@ -0,0 +1,357 @@
+// *****************************************************************************
+// vlc_pixel_convert.cpp                                           Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Conversion of libVLC pictures to the layout expected by OpenGL,
+//    with SIMD kernels selected at run time.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2026, agent <agent@local>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include "vlc_pixel_convert.h"
+#include <QtGlobal>
+#include <QSysInfo>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIXEL_CONVERT_X86
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PIXEL_CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+
+typedef void (*SwizzleRow)(uint *to, const uint *from, unsigned n);
+
+
+
+// ============================================================================
+//
+//   Row kernels: swap R and B in 'n' RV32 pixels
+//
+// ============================================================================
+
+static void swizzleRowScalar(uint *q, const uint *p, unsigned n)
+// ----------------------------------------------------------------------------
+//   Little endian: 0xAARRGGBB -> 0xAABBGGRR
+// ----------------------------------------------------------------------------
+{
+    // Adapted from Qt source code: qgl.cpp
+    // (License: LGPL)
+    const uint *end = p + n;
+    while (p < end)
+    {
+        *q = ((*p << 16) & 0xff0000) | ((*p >> 16) & 0xff)
+                                     | (*p & 0xff00ff00);
+        p++;
+        q++;
+    }
+}
+
+
+static void swizzleRowScalarBigEndian(uint *q, const uint *p, unsigned n)
+// ----------------------------------------------------------------------------
+//   Big endian: 0xAARRGGBB -> 0xRRGGBBAA
+// ----------------------------------------------------------------------------
+{
+    const uint *end = p + n;
+    while (p < end)
+    {
+        *q = (*p << 8) | ((*p >> 24) & 0xff);
+        p++;
+        q++;
+    }
+}
+
+
+#ifdef PIXEL_CONVERT_X86
+__attribute__((target("sse2")))
+static void swizzleRowSSE2(uint *q, const uint *p, unsigned n)
+// ----------------------------------------------------------------------------
+//   SSE2: same as scalar with shifts and masks, 4 pixels at a time
+// ----------------------------------------------------------------------------
+{
+    const __m128i agMask = _mm_set1_epi32(0xff00ff00);
+    const __m128i rbMask = _mm_set1_epi32(0x00ff00ff);
+    unsigned i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i x  = _mm_loadu_si128((const __m128i *) (p + i));
+        __m128i ag = _mm_and_si128(x, agMask);
+        __m128i rb = _mm_and_si128(x, rbMask);
+        rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+        _mm_storeu_si128((__m128i *) (q + i), _mm_or_si128(ag, rb));
+    }
+    swizzleRowScalar(q + i, p + i, n - i);
+}
+
+
+__attribute__((target("ssse3")))
+static void swizzleRowSSSE3(uint *q, const uint *p, unsigned n)
+// ----------------------------------------------------------------------------
+//   SSSE3: one byte shuffle (pshufb) for 4 pixels
+// ----------------------------------------------------------------------------
+{
+    const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 3,  6, 5, 4, 7,
+                                          10, 9, 8, 11, 14, 13, 12, 15);
+    unsigned i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *) (p + i));
+        _mm_storeu_si128((__m128i *) (q + i), _mm_shuffle_epi8(x, shuffle));
+    }
+    swizzleRowScalar(q + i, p + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+static void swizzleRowAVX2(uint *q, const uint *p, unsigned n)
+// ----------------------------------------------------------------------------
+//   AVX2: one byte shuffle for 8 pixels
+// ----------------------------------------------------------------------------
+{
+    const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, 3,  6, 5, 4, 7,
+                                             10, 9, 8, 11, 14, 13, 12, 15,
+                                             2, 1, 0, 3,  6, 5, 4, 7,
+                                             10, 9, 8, 11, 14, 13, 12, 15);
+    unsigned i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (p + i));
+        _mm256_storeu_si256((__m256i *) (q + i),
+                            _mm256_shuffle_epi8(x, shuffle));
+    }
+    swizzleRowSSSE3(q + i, p + i, n - i);
+}
+#endif // PIXEL_CONVERT_X86
+
+
+#ifdef PIXEL_CONVERT_NEON
+static void swizzleRowNEON(uint *q, const uint *p, unsigned n)
+// ----------------------------------------------------------------------------
+//   NEON: de-interleave 16 pixels, swap the B and R planes, re-interleave
+// ----------------------------------------------------------------------------
+{
+    unsigned i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        uint8x16x4_t x = vld4q_u8((const uint8_t *) (p + i));
+        uint8x16_t b = x.val[0];
+        x.val[0] = x.val[2];
+        x.val[2] = b;
+        vst4q_u8((uint8_t *) (q + i), x);
+    }
+    swizzleRowScalar(q + i, p + i, n - i);
+}
+#endif // PIXEL_CONVERT_NEON
+
+
+
+// ============================================================================
+//
+//   Kernel selection
+//
+// ============================================================================
+
+struct SwizzleKernel
+// ----------------------------------------------------------------------------
+//   The row kernel used by convertToGLFormat, selected once at load time
+// ----------------------------------------------------------------------------
+{
+    SwizzleKernel() : row(swizzleRowScalar), name("scalar")
+    {
+        if (QSysInfo::ByteOrder == QSysInfo::BigEndian)
+        {
+            row = swizzleRowScalarBigEndian;
+            name = "scalar (big endian)";
+            return;
+        }
+
+#if defined(PIXEL_CONVERT_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            row = swizzleRowAVX2;
+            name = "avx2";
+        }
+        else if (__builtin_cpu_supports("ssse3"))
+        {
+            row = swizzleRowSSSE3;
+            name = "ssse3";
+        }
+        else if (__builtin_cpu_supports("sse2"))
+        {
+            row = swizzleRowSSE2;
+            name = "sse2";
+        }
+#elif defined(PIXEL_CONVERT_NEON)
+        row = swizzleRowNEON;
+        name = "neon";
+#endif
+    }
+
+    bool select(const char *which)
+    {
+        SwizzleRow r = NULL;
+        const char *n = NULL;
+        if (!strcmp(which, "scalar"))
+        {
+            bool big = QSysInfo::ByteOrder == QSysInfo::BigEndian;
+            r = big ? swizzleRowScalarBigEndian : swizzleRowScalar;
+            n = big ? "scalar (big endian)" : "scalar";
+        }
+        else if (QSysInfo::ByteOrder == QSysInfo::BigEndian)
+        {
+            return false;
+        }
+#if defined(PIXEL_CONVERT_X86)
+        __builtin_cpu_init();
+        if (!strcmp(which, "avx2") && __builtin_cpu_supports("avx2"))
+        {
+            r = swizzleRowAVX2;
+            n = "avx2";
+        }
+        else if (!strcmp(which, "ssse3") && __builtin_cpu_supports("ssse3"))
+        {
+            r = swizzleRowSSSE3;
+            n = "ssse3";
+        }
+        else if (!strcmp(which, "sse2") && __builtin_cpu_supports("sse2"))
+        {
+            r = swizzleRowSSE2;
+            n = "sse2";
+        }
+#elif defined(PIXEL_CONVERT_NEON)
+        if (!strcmp(which, "neon"))
+        {
+            r = swizzleRowNEON;
+            n = "neon";
+        }
+#endif
+        if (!r)
+            return false;
+        row = r;
+        name = n;
+        return true;
+    }
+
+    SwizzleRow   row;
+    const char * name;
+};
+
+static SwizzleKernel kernel;
+
+
+
+// ============================================================================
+//
+//   Image conversion
+//
+// ============================================================================
+
+static void convertRows(SwizzleRow row, void *to, const void *from,
+                        unsigned w, unsigned h,
+                        unsigned x, unsigned y, unsigned rw, unsigned rh)
+// ----------------------------------------------------------------------------
+//   Apply row kernel to the rows of a rectangle, flipping it vertically
+// ----------------------------------------------------------------------------
+//   Row y of the source becomes row h - 1 - y of the destination.
+{
+    const uint *p = (const uint *) from + size_t(y) * w + x;
+    uint *q = (uint *) to + size_t(h - 1 - y) * w + x;
+    for (unsigned i = 0; i < rh; i++, p += w, q -= w)
+        row(q, p, rw);
+}
+
+
+void convertToGLFormat(void *to, const void *from, unsigned w, unsigned h)
+// ----------------------------------------------------------------------------
+//   Convert from RV32 (QImage::Format_RGB32) to GL_RGBA
+// ----------------------------------------------------------------------------
+{
+    if (w && h)
+        convertRows(kernel.row, to, from, w, h, 0, 0, w, h);
+}
+
+
+void convertToGLFormat(void *to, const void *from, unsigned w, unsigned h,
+                       unsigned x, unsigned y, unsigned rw, unsigned rh)
+// ----------------------------------------------------------------------------
+//   Convert only a rectangle, to where it is in the flipped image
+// ----------------------------------------------------------------------------
+{
+    if (rw && rh && x + rw <= w && y + rh <= h)
+        convertRows(kernel.row, to, from, w, h, x, y, rw, rh);
+}
+
+
+void verticalFlip16(void *to, const void *from, unsigned w, unsigned h)
+// ----------------------------------------------------------------------------
+//   Flip 16-bit image vertically
+// ----------------------------------------------------------------------------
+//   Rows are copied unchanged, so memcpy() (vectorized by the C library)
+//   does all the work.
+{
+    verticalFlip16(to, from, w, h, 0, 0, w, h);
+}
+
+
+void verticalFlip16(void *to, const void *from, unsigned w, unsigned h,
+                    unsigned x, unsigned y, unsigned rw, unsigned rh)
+// ----------------------------------------------------------------------------
+//   Flip only a rectangle of a 16-bit image, to where it is in the result
+// ----------------------------------------------------------------------------
+{
+    if (!rw || !rh || x + rw > w || y + rh > h)
+        return;
+    size_t bpl = size_t(w) * 2;
+    const char *p = (const char *) from + y * bpl + x * 2;
+    char *q = (char *) to + (h - 1 - y) * bpl + x * 2;
+    for (unsigned i = 0; i < rh; i++, p += bpl, q -= bpl)
+        memcpy(q, p, size_t(rw) * 2);
+}
+
+
+const char *pixelConvertKernel()
+// ----------------------------------------------------------------------------
+//   Return the name of the kernel selected for this CPU
+// ----------------------------------------------------------------------------
+{
+    return kernel.name;
+}
+
+
+bool selectPixelConvertKernel(const char *name)
+// ----------------------------------------------------------------------------
+//   Force a kernel, so that tests can compare each of them to the reference
+// ----------------------------------------------------------------------------
+{
+    return kernel.select(name);
+}
@@ -0,0 +1,62 @@
+#ifndef VLC_PIXEL_CONVERT_H
+#define VLC_PIXEL_CONVERT_H
+// *****************************************************************************
+// vlc_pixel_convert.h                                             Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Conversion of libVLC pictures to the layout expected by OpenGL,
+//    with SIMD kernels selected at run time.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2026, agent <agent@local>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+// Convert RV32 to GL_RGBA and flip vertically, using the best kernel
+void         convertToGLFormat(void *to, const void *from,
+                               unsigned w, unsigned h);
+
+// Same, for the rectangle at x, y of size rw x rh only
+void         convertToGLFormat(void *to, const void *from,
+                               unsigned w, unsigned h,
+                               unsigned x, unsigned y,
+                               unsigned rw, unsigned rh);
+
+// Flip a 16-bit per pixel image (UYVY) vertically
+void         verticalFlip16(void *to, const void *from,
+                            unsigned w, unsigned h);
+void         verticalFlip16(void *to, const void *from,
+                            unsigned w, unsigned h,
+                            unsigned x, unsigned y,
+                            unsigned rw, unsigned rh);
+
+// Name of the kernel used by convertToGLFormat, e.g. "avx2"
+const char * pixelConvertKernel();
+
+// Use the named kernel from now on, if the CPU supports it (for tests)
+bool         selectPixelConvertKernel(const char *name);
+
+#endif // VLC_PIXEL_CONVERT_H
@@ -0,0 +1,499 @@
+// *****************************************************************************
+// vlc_thumbnails.cpp                                              Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Thumbnails of evenly spaced frames of a media, decoded in the
+//    background and packed into one texture, for scrubbing timelines.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2026, agent <agent@local>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include "tao/graphic_state.h"
+#include "tao/tao_gl.h"
+#include "vlc_thumbnails.h"
+#include "vlc_video_base.h"
+#include "vlc_pixel_convert.h"
+#include "base.h"  // IFTRACE()
+#include <qgl.h>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QOpenGLContext>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <vlc/libvlc_events.h>
+#include <math.h>
+#include <string.h>
+#include <iostream>
+
+
+QThreadPool *VlcThumbnails::workers = NULL;
+
+
+VlcThumbnails::VlcThumbnails(libvlc_instance_t *vlc, QString path,
+                             unsigned count, unsigned width)
+// ----------------------------------------------------------------------------
+//   Load the atlas from the cache, or start decoding thumbnails
+// ----------------------------------------------------------------------------
+//   Called from the render thread, so that the texture size can be checked.
+    : vlc(vlc), path(path), count(count), requested(width),
+      columns(ceil(sqrt(double(count)))),
+      rows((count + columns - 1) / columns),
+      width(width), height(0), maxHeight(MAX_WIDTH),
+      refs(1), remaining(count), failed(0), cancelled(0),
+      reload(false), tex(0), context(NULL)
+{
+    // Workers may outlive a new vlc_init
+    libvlc_retain(vlc);
+
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    if (maxSize > 0)
+    {
+        this->width = qMin(width, unsigned(maxSize) / columns);
+        maxHeight = qMin(maxHeight, unsigned(maxSize) / rows);
+    }
+
+    // The atlas and the texture both take 4 bytes per pixel
+    unsigned cell = MAX_PIXELS / (columns * rows);
+    this->width = qMax(2u, qMin(this->width, unsigned(sqrt(double(cell)))));
+    maxHeight = qMax(2u, qMin(maxHeight, cell / this->width));
+
+    if (load())
+    {
+        IFTRACE(video)
+            std::cerr << "[VlcThumbnails " << (void *) this << "] "
+                      << count << " thumbnails from the cache\n";
+        remaining.storeRelease(0);
+        return;
+    }
+
+    unsigned workerCount = qMin(count, unsigned(MAX_WORKERS));
+    for (unsigned w = 0; w < workerCount; w++)
+    {
+        ref();
+        pool()->start(new Worker(this, w));
+    }
+}
+
+
+VlcThumbnails::~VlcThumbnails()
+// ----------------------------------------------------------------------------
+//   Called by the last of the main thread and workers
+// ----------------------------------------------------------------------------
+{
+    libvlc_release(vlc);
+}
+
+
+void VlcThumbnails::drop()
+// ----------------------------------------------------------------------------
+//   Main thread: release the atlas. Workers stop at the next thumbnail
+// ----------------------------------------------------------------------------
+{
+    cancelled.storeRelease(1);
+    releaseTexture();
+    unref();
+}
+
+
+void VlcThumbnails::releaseTexture()
+// ----------------------------------------------------------------------------
+//   Render thread: delete the texture in the context where it was created
+// ----------------------------------------------------------------------------
+//   The context is made current for that, then the previous one is restored.
+//   A context that was destroyed took the texture with it.
+{
+    if (tex && handle)
+    {
+        const QGLContext *current = QGLContext::currentContext();
+        if (current != context)
+            const_cast<QGLContext *>(context)->makeCurrent();
+        GL.DeleteTextures(1, &tex);
+        if (current && current != context)
+            const_cast<QGLContext *>(current)->makeCurrent();
+    }
+    tex = 0;
+}
+
+
+void VlcThumbnails::stop()
+// ----------------------------------------------------------------------------
+//   Wait until workers are done, e.g. before unloading the module
+// ----------------------------------------------------------------------------
+{
+    if (!workers)
+        return;
+    workers->waitForDone();
+    delete workers;
+    workers = NULL;
+}
+
+
+QThreadPool *VlcThumbnails::pool()
+// ----------------------------------------------------------------------------
+//   The threads decoding thumbnails, at most MAX_WORKERS
+// ----------------------------------------------------------------------------
+{
+    if (!workers)
+    {
+        workers = new QThreadPool;
+        workers->setMaxThreadCount(MAX_WORKERS);
+    }
+    return workers;
+}
+
+
+GLuint VlcThumbnails::texture(unsigned *w, unsigned *h)
+// ----------------------------------------------------------------------------
+//   Render thread: upload the cells stored since last time, return the texture
+// ----------------------------------------------------------------------------
+//   The texture is only made again for a new atlas or a new context. The
+//   lock is held while uploading, workers only take it to store a cell.
+{
+    const QGLContext *current = QGLContext::currentContext();
+    QMutexLocker locker(&mutex);
+    if (atlas.isNull())
+        return 0;
+    unsigned iw = atlas.width(), ih = atlas.height();
+    *w = iw;
+    *h = ih;
+    if (current != context)
+    {
+        // Texture names are not shared with the previous context
+        releaseTexture();
+        context = current;
+        handle = current ? current->contextHandle() : NULL;
+        reload = true;
+    }
+    if (!reload && dirty.isEmpty())
+        return tex;
+
+    if (!tex)
+        GL.GenTextures(1, &tex);
+    GL.BindTexture(GL_TEXTURE_2D, tex);
+    if (reload)
+    {
+        GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        GL.TexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, iw, ih, 0,
+                      GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        dirty.clear();
+        for (unsigned k = 0; k < columns * rows; k++)
+            dirty.append(k);
+        reload = false;
+    }
+
+    QVector<uchar> pixels;
+    foreach (unsigned k, dirty)
+        uploadCell(k, pixels);
+    dirty.clear();
+    return tex;
+}
+
+
+void VlcThumbnails::uploadCell(unsigned k, QVector<uchar> &pixels)
+// ----------------------------------------------------------------------------
+//   Convert cell k of the atlas and upload it into the bound texture
+// ----------------------------------------------------------------------------
+//   The texture is flipped vertically, as with convertToGLFormat().
+{
+    unsigned x = (k % columns) * width;
+    unsigned y = (k / columns) * height;
+    unsigned pitch = width * 4;
+    pixels.resize(pitch * height);
+    for (unsigned row = 0; row < height; row++)
+        convertToGLFormat(pixels.data() + (height - 1 - row) * pitch,
+                          atlas.constScanLine(y + row) + x * 4, width, 1);
+    GL.TexSubImage2D(GL_TEXTURE_2D, 0, x, atlas.height() - y - height,
+                     width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+                     pixels.constData());
+}
+
+
+void VlcThumbnails::Worker::run()
+// ----------------------------------------------------------------------------
+//   Pool thread: decode our share of the thumbnails
+// ----------------------------------------------------------------------------
+{
+    strip->decode(first);
+    strip->unref();
+}
+
+
+void VlcThumbnails::decode(unsigned first)
+// ----------------------------------------------------------------------------
+//   Decode thumbnails first, first + MAX_WORKERS, ... with our own player
+// ----------------------------------------------------------------------------
+{
+    qint64 length = 0;
+    if (libvlc_media_t *media = newMedia())
+    {
+        libvlc_media_parse(media);
+        length = libvlc_media_get_duration(media);
+        libvlc_media_release(media);
+    }
+
+    Decoder d(this);
+    libvlc_media_player_t *player = libvlc_media_player_new(vlc);
+    libvlc_video_set_callbacks(player, lockFrame, NULL, displayFrame, &d);
+    libvlc_video_set_format_callbacks(player, formatFrame, NULL);
+    libvlc_event_attach(libvlc_media_player_event_manager(player),
+                        libvlc_MediaPlayerTimeChanged, timeChanged, &d);
+
+    for (unsigned k = first; k < count; k += MAX_WORKERS)
+    {
+        if (length > 0 && !cancelled.loadAcquire() &&
+            decodeOne(player, d, k, length))
+            store(k, d);
+        else
+            failed.storeRelease(1);
+
+        // The last thumbnail saves the atlas
+        if (remaining.fetchAndAddOrdered(-1) == 1 && !failed.loadAcquire())
+            save();
+    }
+    libvlc_media_player_release(player);
+}
+
+
+bool VlcThumbnails::decodeOne(libvlc_media_player_t *player, Decoder &d,
+                              unsigned k, qint64 length)
+// ----------------------------------------------------------------------------
+//   Play the media from the time of thumbnail k until a frame comes
+// ----------------------------------------------------------------------------
+//   Seeking to the nearest keyframe is enough for a thumbnail, and faster.
+{
+    libvlc_media_t *media = newMedia();
+    if (!media)
+        return false;
+    double t = (k + 0.5) * length / count * 0.001;
+    QString start = ":start-time=" + QString::number(t, 'f', 3);
+    libvlc_media_add_option(media, ":no-audio");
+    libvlc_media_add_option(media, ":input-fast-seek");
+    libvlc_media_add_option(media, start.toUtf8().constData());
+    libvlc_media_player_set_media(player, media);
+    libvlc_media_release(media);
+
+    d.mutex.lock();
+    d.timed = d.done = false;
+    d.mutex.unlock();
+    libvlc_media_player_play(player);
+
+    QElapsedTimer timer;
+    timer.start();
+    d.mutex.lock();
+    while (!d.done && !cancelled.loadAcquire() &&
+           timer.elapsed() < FRAME_TIMEOUT)
+        d.cond.wait(&d.mutex, WAIT_SLICE);
+    bool done = d.done;
+    d.mutex.unlock();
+
+    // Once stopped, libVLC does not write into d.pixels anymore
+    libvlc_media_player_stop(player);
+    IFTRACE(video)
+        if (!done)
+            std::cerr << "[VlcThumbnails " << (void *) this << "] "
+                      << "No frame at " << t << " s\n";
+    return done;
+}
+
+
+void VlcThumbnails::store(unsigned k, Decoder &d)
+// ----------------------------------------------------------------------------
+//   Copy the frame decoded for thumbnail k into its cell
+// ----------------------------------------------------------------------------
+{
+    QMutexLocker locker(&mutex);
+    unsigned pitch = width * 4;
+    if (atlas.isNull() || unsigned(d.pixels.size()) < pitch * height)
+        return;
+    unsigned x = (k % columns) * width;
+    unsigned y = (k / columns) * height;
+    for (unsigned row = 0; row < height; row++)
+        memcpy(atlas.scanLine(y + row) + x * 4,
+               d.pixels.constData() + row * pitch, pitch);
+    dirty.append(k);
+    locker.unlock();
+
+    VlcVideoBase::wakeUp();
+}
+
+
+libvlc_media_t *VlcThumbnails::newMedia()
+// ----------------------------------------------------------------------------
+//   A new media for the file or URL
+// ----------------------------------------------------------------------------
+{
+    QByteArray name = path.toUtf8();
+    if (path.contains("://"))
+        return libvlc_media_new_location(vlc, name.constData());
+    return libvlc_media_new_path(vlc, name.constData());
+}
+
+
+QString VlcThumbnails::cachePath()
+// ----------------------------------------------------------------------------
+//   PNG file of the atlas, which changes if the media file changes
+// ----------------------------------------------------------------------------
+{
+    QFileInfo info(path);
+    QString key = info.absoluteFilePath() + "|" +
+                  QString::number(info.size()) + "|" +
+                  QString::number(info.lastModified().toMSecsSinceEpoch()) +
+                  "|" + QString::number(count) + "x" + QString::number(width);
+    QByteArray hash = QCryptographicHash::hash(key.toUtf8(),
+                                               QCryptographicHash::Sha1);
+    QString dir = QStandardPaths::writableLocation(
+        QStandardPaths::CacheLocation);
+    return dir + "/vlc_thumbnails/" + QString::fromLatin1(hash.toHex()) +
+           ".png";
+}
+
+
+bool VlcThumbnails::load()
+// ----------------------------------------------------------------------------
+//   Read the atlas saved by a previous run, only for local files
+// ----------------------------------------------------------------------------
+{
+    if (path.contains("://"))
+        return false;
+    QImage image;
+    if (!image.load(cachePath()) ||
+        unsigned(image.width()) != columns * width ||
+        image.height() % rows != 0 ||
+        unsigned(image.height()) / rows > maxHeight)
+        return false;
+
+    QMutexLocker locker(&mutex);
+    atlas = image.convertToFormat(QImage::Format_RGB32);
+    if (atlas.isNull())
+        return false;
+    height = atlas.height() / rows;
+    reload = true;
+    return true;
+}
+
+
+void VlcThumbnails::save()
+// ----------------------------------------------------------------------------
+//   Write the atlas to the cache once all thumbnails are decoded
+// ----------------------------------------------------------------------------
+{
+    if (path.contains("://"))
+        return;
+    QString name = cachePath();
+    QDir().mkpath(QFileInfo(name).path());
+
+    QMutexLocker locker(&mutex);
+    if (!atlas.isNull())
+        atlas.save(name, "PNG");
+}
+
+
+unsigned VlcThumbnails::formatFrame(void **opaque, char *chroma,
+                                    unsigned *w, unsigned *h,
+                                    unsigned *pitches, unsigned *lines)
+// ----------------------------------------------------------------------------
+//   libVLC thread: decode frames as RV32 at the size of a cell
+// ----------------------------------------------------------------------------
+//   The first frame sets the height of cells, from the aspect ratio. It is
+//   limited by maxHeight, so very tall videos are squeezed vertically.
+//   Returning 0 makes libVLC fail, e.g. if there is no memory for the atlas.
+{
+    Decoder *d = (Decoder *) *opaque;
+    VlcThumbnails *s = d->strip;
+
+    s->mutex.lock();
+    if (!s->height)
+    {
+        unsigned height = *w ? s->width * *h / *w : s->width;
+        height = qMax(2u, qMin(height, s->maxHeight) & ~1u);
+        s->atlas = QImage(s->columns * s->width, s->rows * height,
+                          QImage::Format_RGB32);
+        if (s->atlas.isNull())
+        {
+            s->mutex.unlock();
+            return 0;
+        }
+        s->height = height;
+        s->atlas.fill(0);
+        s->reload = true;
+    }
+    memcpy(chroma, "RV32", 4);
+    *w = s->width;
+    *h = s->height;
+    s->mutex.unlock();
+
+    *pitches = *w * 4;
+    *lines = *h;
+    d->pixels.resize(*pitches * *lines);
+    return 1;
+}
+
+
+void *VlcThumbnails::lockFrame(void *opaque, void **planes)
+// ----------------------------------------------------------------------------
+//   libVLC thread: all frames go to the same buffer, only one is kept
+// ----------------------------------------------------------------------------
+{
+    Decoder *d = (Decoder *) opaque;
+    planes[0] = d->pixels.data();
+    return NULL;
+}
+
+
+void VlcThumbnails::displayFrame(void *opaque, void *)
+// ----------------------------------------------------------------------------
+//   libVLC thread: wake up decodeOne() if the frame is at the right time
+// ----------------------------------------------------------------------------
+{
+    Decoder *d = (Decoder *) opaque;
+    QMutexLocker locker(&d->mutex);
+    if (d->timed)
+    {
+        d->done = true;
+        d->cond.wakeAll();
+    }
+}
+
+
+void VlcThumbnails::timeChanged(const struct libvlc_event_t *, void *opaque)
+// ----------------------------------------------------------------------------
+//   libVLC reports a time: frames from before start-time are gone (#3026)
+// ----------------------------------------------------------------------------
+{
+    Decoder *d = (Decoder *) opaque;
+    QMutexLocker locker(&d->mutex);
+    d->timed = true;
+}
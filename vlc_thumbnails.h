@@ -0,0 +1,160 @@
+#ifndef VLC_THUMBNAILS_H
+#define VLC_THUMBNAILS_H
+// *****************************************************************************
+// vlc_thumbnails.h                                                Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Thumbnails of evenly spaced frames of a media, decoded in the
+//    background and packed into one texture, for scrubbing timelines.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2026, agent <agent@local>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include "tao/tao_gl.h"
+#include <QAtomicInt>
+#include <QImage>
+#include <QMutex>
+#include <QPointer>
+#include <QRunnable>
+#include <QString>
+#include <QVector>
+#include <QWaitCondition>
+#include <vlc/libvlc.h>
+#include <vlc/libvlc_media.h>
+#include <vlc/libvlc_media_player.h>
+
+class QGLContext;
+class QOpenGLContext;
+class QThreadPool;
+
+
+struct VlcThumbnails
+// ----------------------------------------------------------------------------
+//   Evenly spaced frames of a media, decoded in the background into an atlas
+// ----------------------------------------------------------------------------
+//   Thumbnail k shows the frame at (k + 0.5) / count of the media. It is in
+//   the cell at column k % columns and row k / columns from the top, with
+//   'columns' the smallest number whose square is at least 'count'.
+//   Cells are narrowed and shortened so that the atlas fits in the largest
+//   texture of the GL implementation, and in MAX_PIXELS. The texture is
+//   made once, then only the cells decoded since are uploaded.
+//   At most MAX_WORKERS threads decode thumbnails, each with its own libVLC
+//   player. The atlas of a local file is saved as PNG in the cache
+//   directory, and loaded instead next time.
+{
+public:
+    enum { MAX_WORKERS = 2, MAX_COUNT = 256, MAX_WIDTH = 512,
+           MAX_PIXELS = 1 << 22,                     // Of the atlas
+           FRAME_TIMEOUT = 5000, WAIT_SLICE = 100 }; // ms
+
+public:
+    VlcThumbnails(libvlc_instance_t *vlc, QString path,
+                  unsigned count, unsigned width);
+    void           drop();
+    static void    stop();
+
+public:
+    bool           matches(QString p, unsigned n, unsigned w)
+    {
+        return p == path && n == count && w == requested;
+    }
+    bool           complete()    { return remaining.loadAcquire() == 0; }
+    GLuint         texture(unsigned *w, unsigned *h);
+
+protected:
+    struct Worker : QRunnable
+    {
+        Worker(VlcThumbnails *strip, unsigned first)
+            : strip(strip), first(first) {}
+        virtual void run();
+
+        VlcThumbnails *         strip;
+        unsigned                first;  // Then every MAX_WORKERS
+    };
+
+    struct Decoder
+    {
+        Decoder(VlcThumbnails *strip)
+            : strip(strip), timed(false), done(false) {}
+
+        VlcThumbnails *         strip;
+        QVector<uchar>          pixels; // RV32, the size of a cell
+        bool                    timed;  // libVLC reported a time, see #3026
+        bool                    done;   // A frame came after that
+        QMutex                  mutex;
+        QWaitCondition          cond;
+    };
+
+protected:
+    ~VlcThumbnails();
+    void           ref()   { refs.ref(); }
+    void           unref() { if (!refs.deref()) delete this; }
+    void           decode(unsigned first);
+    bool           decodeOne(libvlc_media_player_t *player, Decoder &d,
+                             unsigned k, qint64 length);
+    void           store(unsigned k, Decoder &d);
+    void           releaseTexture();
+    void           uploadCell(unsigned k, QVector<uchar> &pixels);
+    libvlc_media_t * newMedia();
+    QString        cachePath();
+    bool           load();
+    void           save();
+    static QThreadPool * pool();
+
+protected:
+    static unsigned formatFrame(void **opaque, char *chroma,
+                                unsigned *w, unsigned *h,
+                                unsigned *pitches, unsigned *lines);
+    static void *  lockFrame(void *opaque, void **planes);
+    static void    displayFrame(void *opaque, void *picture);
+    static void    timeChanged(const struct libvlc_event_t *, void *opaque);
+
+protected:
+    libvlc_instance_t *     vlc;
+    QString                 path;
+    unsigned                count, requested;
+    unsigned                columns, rows;
+    unsigned                width;      // Of cells, fits GL_MAX_TEXTURE_SIZE
+    unsigned                height;     // Of cells, from the first frame
+    unsigned                maxHeight;  // Of cells, fits GL_MAX_TEXTURE_SIZE
+    QAtomicInt              refs;       // Ours, and one per worker
+    QAtomicInt              remaining;  // Thumbnails not tried yet
+    QAtomicInt              failed;     // Some thumbnail failed, don't save
+    QAtomicInt              cancelled;  // See drop()
+    QMutex                  mutex;      // Protect atlas, height and dirty
+    QImage                  atlas;
+    QVector<unsigned>       dirty;      // Cells stored since uploaded
+    bool                    reload;     // New atlas or context: all cells
+    GLuint                  tex;
+    const QGLContext *      context;    // Where tex was created
+    QPointer<QOpenGLContext> handle;    // Of context, NULL once destroyed
+
+    static QThreadPool *    workers;
+};
+
+#endif // VLC_THUMBNAILS_H
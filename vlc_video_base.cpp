@@ -38,10 +38,14 @@
 
 #include "vlc_audio_video.h"
 #include "vlc_video_base.h"
+#include "vlc_media_index.h"
 #include "base.h"  // IFTRACE()
 #include <vlc/libvlc_events.h>
 #include <vlc/libvlc_media_list.h>
+#include <vlc/libvlc_version.h>
 #include <string.h>
+#include <QCoreApplication>
+#include <QEvent>
 #include <QMutexLocker>
 #include <QVector>
 #include <QTime>
@@ -74,10 +78,13 @@ VlcVideoBase::VlcVideoBase(QString mediaNameAndOptions)
 // ----------------------------------------------------------------------------
 //   Initialize a VLC media player to render a video
 // ----------------------------------------------------------------------------
-    : lastTime(-1.0), lastRate(1.0), frameTime(0), fps(-1),
+    : lastTime(-1.0), lastRate(1.0), frameTime(0),
       offline(false),
       vlc(VlcAudioVideo::vlcInstance()), player(NULL), media(NULL),
-      state(VS_STOPPED), mevm(NULL), pevm(NULL), loopMode(false)
+      state(VS_STOPPED), mevm(NULL), pevm(NULL), loopMode(false),
+      anchorTime(0), driftCount(0), driftTotal(0), driftMax(0),
+      syncGroup(NULL), groupOffset(0), userRate(1.0), syncNudge(1.0),
+      groupHeld(false), index(NULL), shownFrame(-1)
 {
     if (!vlc)
     {
@@ -102,6 +109,9 @@ VlcVideoBase::VlcVideoBase(QString mediaNameAndOptions)
     libvlc_event_attach(pevm,
                         libvlc_MediaPlayerEndReached, playerEndReached,
                         this);
+    libvlc_event_attach(pevm,
+                        libvlc_MediaPlayerTimeChanged, playerTimeUpdated,
+                        this);
 
     // Save path/URL and options
     this->mediaName = mediaNameAndOptions;
@@ -131,6 +141,11 @@ VlcVideoBase::~VlcVideoBase()
 {
     IFTRACE(video)
         debug() << "Deleting media player and media\n";
+    setSyncGroup("");
+    IFTRACE(video)
+        debug() << "Clock drift: " << clockDrift() * 1000 << " ms average, "
+                << driftMax * 1000 << " ms max over " << driftCount
+                << " update(s)\n";
 
     if (player)
     {
@@ -142,6 +157,8 @@ VlcVideoBase::~VlcVideoBase()
         libvlc_media_release(media);
     foreach (char *opt, mediaOptions)
         free(opt);
+    if (index)
+        index->unref();
 }
 
 
@@ -177,6 +194,8 @@ void VlcVideoBase::next_frame()
     if (state != VS_PAUSED)
         return;
     libvlc_media_player_next_frame(player);
+    if (shownFrame >= 0)
+        shownFrame++;
 }
 
 
@@ -248,10 +267,281 @@ void VlcVideoBase::setState(State state)
 {
     IFTRACE(video)
         debug() << "New state: " << stateName(state) << "\n";
+
+    // The clock only runs while playing: freeze it or restart it
+    if ((state == VS_PLAYING) != (this->state == VS_PLAYING))
+        anchorClock(clockTime());
+    if (state != VS_PAUSED)
+        shownFrame = -1;
+    if (state != VS_PLAYING)
+        groupHeld = false;
+
+    if (this->state != state)
+        wakeUp();
     this->state = state;
 }
 
 
+void VlcVideoBase::anchorClock(double t, bool measureDrift)
+// ----------------------------------------------------------------------------
+//   Media is at time t now, in seconds
+// ----------------------------------------------------------------------------
+//   With measureDrift, t comes from libVLC, and we record how far the
+//   clock model was from it. Larger differences are seeks, not drift.
+{
+    QMutexLocker locker(&clockMutex);
+    if (measureDrift && state == VS_PLAYING && clockAnchor.isValid())
+    {
+        double model = anchorTime + clockAnchor.nsecsElapsed()*1e-9*lastRate;
+        double drift = fabs(t - model);
+        if (drift < 1.0)
+        {
+            driftCount++;
+            driftTotal += drift;
+            if (driftMax < drift)
+                driftMax = drift;
+        }
+    }
+    anchorTime = t;
+    clockAnchor.start();
+}
+
+
+double VlcVideoBase::clockTime()
+// ----------------------------------------------------------------------------
+//   Media time in seconds, from the last libVLC time and the rate
+// ----------------------------------------------------------------------------
+{
+    QMutexLocker locker(&clockMutex);
+    double t = anchorTime;
+    if (state == VS_PLAYING && clockAnchor.isValid())
+        t += clockAnchor.nsecsElapsed() * 1e-9 * lastRate;
+    return t;
+}
+
+
+const double VlcVideoBase::SYNC_GAIN      = 0.5;
+const double VlcVideoBase::SYNC_MAX_NUDGE = 0.05;
+const double VlcVideoBase::SYNC_SEEK      = 0.5;
+QMap<QString, VlcSyncGroup *> VlcSyncGroup::groups;
+QAtomicPointer<QObject> VlcVideoBase::wakeUpTarget;
+QAtomicInt              VlcVideoBase::wakeUpPending;
+
+
+void VlcVideoBase::setSyncGroup(QString name)
+// ----------------------------------------------------------------------------
+//   Join the sync group with the given name, or leave the current one
+// ----------------------------------------------------------------------------
+{
+    if (syncGroup)
+    {
+        QString old = VlcSyncGroup::groups.key(syncGroup);
+        if (old == name)
+            return;
+        IFTRACE(video)
+            debug() << "Leaving sync group " << +old << "\n";
+        syncGroup->members.removeAll(this);
+        if (syncGroup->members.isEmpty())
+        {
+            VlcSyncGroup::groups.remove(old);
+            delete syncGroup;
+        }
+        syncGroup = NULL;
+        groupOffset = 0;
+        if (groupHeld)
+        {
+            libvlc_media_player_set_pause(player, false);
+            groupHeld = false;
+        }
+        if (vlc && syncNudge != 1.0)
+        {
+            syncNudge = 1.0;
+            applyRate();
+        }
+    }
+    if (name.isEmpty())
+        return;
+
+    IFTRACE(video)
+        debug() << "Joining sync group " << +name << "\n";
+    VlcSyncGroup *&group = VlcSyncGroup::groups[name];
+    if (!group)
+        group = new VlcSyncGroup;
+    group->members.append(this);
+    syncGroup = group;
+}
+
+
+void VlcVideoBase::syncToGroup()
+// ----------------------------------------------------------------------------
+//   Follow the clock of the sync group by nudging the rate of libVLC
+// ----------------------------------------------------------------------------
+//   Members start together, see startGroup(). The clock then stops while
+//   no member plays. The rate of libVLC is userRate times syncNudge, which
+//   changes by SYNC_GAIN per second of offset, at most by SYNC_MAX_NUDGE,
+//   in steps so that libVLC is not called on every frame. Offsets larger
+//   than SYNC_SEEK, e.g. for a member that joined late, are corrected with
+//   a seek. Looping members follow the group clock modulo their length.
+{
+    if (offline || !vlc)
+        return;
+
+    // When all members stopped, they start together again
+    VlcSyncGroup *group = syncGroup;
+    bool active = false;
+    foreach (VlcVideoBase *m, group->members)
+        if (m->state == VS_PLAYING || m->state == VS_PAUSED ||
+            m->state == VS_STARTING)
+            active = true;
+    if (!active && group->started)
+    {
+        IFTRACE(video)
+            debug() << "Sync group stopped\n";
+        group->reset();
+    }
+    if (!group->started && !startGroup())
+        return;
+
+    // The clock does not run while all members are paused
+    bool running = false;
+    foreach (VlcVideoBase *m, group->members)
+        if (m->state == VS_PLAYING)
+            running = true;
+    group->setRunning(running);
+    if (state != VS_PLAYING)
+        return;
+
+    double t = clockTime();
+    double target = group->time();
+    double len = length();
+    if (loopMode && len > 0)
+    {
+        target = fmod(target, len);
+        double offset = t - target;
+        if (offset > len / 2)
+            t -= len;
+        else if (offset < -len / 2)
+            t += len;
+    }
+    groupOffset = t - target;
+
+    if (fabs(groupOffset) > SYNC_SEEK)
+    {
+        // Let a seek settle before the next one
+        if (!lastSyncSeek.isValid() || lastSyncSeek.elapsed() > 2000)
+        {
+            IFTRACE(video)
+                debug() << "Sync group offset " << groupOffset
+                        << " s, seeking to " << target << " s\n";
+            seekTo(target);
+            lastSyncSeek.start();
+        }
+        return;
+    }
+
+    double nudge = qBound(-SYNC_MAX_NUDGE, -groupOffset * SYNC_GAIN,
+                          SYNC_MAX_NUDGE);
+    nudge = 1.0 + qRound(nudge * SYNC_NUDGE_STEPS) / double(SYNC_NUDGE_STEPS);
+    if (nudge != syncNudge)
+    {
+        syncNudge = nudge;
+        applyRate();
+    }
+}
+
+
+bool VlcVideoBase::startGroup()
+// ----------------------------------------------------------------------------
+//   Hold members that play until all do, then start the clock of the group
+// ----------------------------------------------------------------------------
+//   Members that are not playing after SYNC_START_TIMEOUT join later, with
+//   a seek. Returns true once the group started.
+{
+    VlcSyncGroup *group = syncGroup;
+    if (state == VS_PLAYING && !groupHeld)
+    {
+        libvlc_media_player_set_pause(player, true);
+        groupHeld = true;
+        if (!group->waiting.isValid())
+            group->waiting.start();
+    }
+    if (!group->waiting.isValid())
+        return false;
+
+    bool ready = true;
+    foreach (VlcVideoBase *m, group->members)
+        if (!m->groupHeld)
+            ready = false;
+    if (!ready && group->waiting.elapsed() < SYNC_START_TIMEOUT)
+        return false;
+
+    // Held members are all on their first frame
+    group->origin = -1;
+    foreach (VlcVideoBase *m, group->members)
+        if (m->groupHeld && group->origin < 0)
+            group->origin = libvlc_media_player_get_time(m->player) * 0.001;
+    group->origin = qMax(group->origin, 0.0);
+    group->rate = userRate;
+    group->started = true;
+    IFTRACE(video)
+        debug() << "Starting clock of sync group at " << group->origin
+                << " s\n";
+    foreach (VlcVideoBase *m, group->members)
+    {
+        if (!m->groupHeld)
+            continue;
+        libvlc_media_player_set_pause(m->player, false);
+        m->groupHeld = false;
+        m->anchorClock(group->origin);
+    }
+    return true;
+}
+
+
+void VlcVideoBase::wakeUp()
+// ----------------------------------------------------------------------------
+//   Any thread: have Tao redraw the page, e.g. when a frame arrived
+// ----------------------------------------------------------------------------
+//   A single event is posted until the page is drawn again, see
+//   setWakeUpTarget(). Tao refreshes the layouts that asked for it.
+{
+    QObject *target = wakeUpTarget.loadAcquire();
+    if (target && wakeUpPending.testAndSetOrdered(0, 1))
+        QCoreApplication::postEvent(target,
+                                    new QEvent(QEvent::Type(wakeUpEvent())));
+}
+
+
+void VlcVideoBase::setWakeUpTarget(QObject *target)
+// ----------------------------------------------------------------------------
+//   Render thread: the page is drawn, post wake-up events to target
+// ----------------------------------------------------------------------------
+{
+    wakeUpTarget.storeRelease(target);
+    wakeUpPending.storeRelease(0);
+}
+
+
+int VlcVideoBase::wakeUpEvent()
+// ----------------------------------------------------------------------------
+//   Type of the events posted by wakeUp()
+// ----------------------------------------------------------------------------
+{
+    static int type = QEvent::registerEventType();
+    return type;
+}
+
+
+double VlcVideoBase::clockDrift()
+// ----------------------------------------------------------------------------
+//   Average difference between the clock model and libVLC, in seconds
+// ----------------------------------------------------------------------------
+{
+    QMutexLocker locker(&clockMutex);
+    return driftCount ? driftTotal / driftCount : 0.0;
+}
+
+
 void VlcVideoBase::getMediaSubItems()
 // ----------------------------------------------------------------------------
 //   After playback when media is a playlist: get subitem(s)
@@ -293,16 +583,30 @@ void VlcVideoBase::startPlayback()
 
     libvlc_media_player_set_media(player, media);
     libvlc_media_player_play(player);
+    anchorClock(0);
 
     setState(VS_STARTING);
 }
 
 
+bool VlcVideoBase::seekCached(double t)
+// ----------------------------------------------------------------------------
+//   Seek to time t without libVLC, if frames are shown from memory
+// ----------------------------------------------------------------------------
+{
+    Q_UNUSED(t);
+    return false;
+}
+
+
 void VlcVideoBase::exec()
 // ----------------------------------------------------------------------------
 //   Run state machine in main thread
 // ----------------------------------------------------------------------------
 {
+    if (syncGroup)
+        syncToGroup();
+
     switch (state)
     {
     case VS_ALL_SUBITEMS_RECEIVED:
@@ -382,6 +686,18 @@ void VlcVideoBase::playerError(const struct libvlc_event_t *, void *obj)
 }
 
 
+void VlcVideoBase::playerTimeUpdated(const struct libvlc_event_t *e,
+                                     void *obj)
+// ----------------------------------------------------------------------------
+//   Refresh the clock model when libVLC reports a new time
+// ----------------------------------------------------------------------------
+{
+    VlcVideoBase *v = (VlcVideoBase *)obj;
+    v->anchorClock(e->u.media_player_time_changed.new_time * 0.001, true);
+    wakeUp();                   // Time shown on the page changed
+}
+
+
 void VlcVideoBase::mediaSubItemAdded(const struct libvlc_event_t *,
                                      void *obj)
 // ----------------------------------------------------------------------------
@@ -431,9 +747,15 @@ float VlcVideoBase::time()
 // ----------------------------------------------------------------------------
 //   Return current time in seconds
 // ----------------------------------------------------------------------------
+//   Interpolated from the last time libVLC reported, see anchorClock(),
+//   which costs no call to libVLC. Offline rendering does not follow the
+//   wall clock, so it counts frames instead.
 {
     if (!vlc)
         return 0.0;
+    if (!offline)
+        return lastTime = clockTime();
+
     double vlcTime = libvlc_media_player_get_time(player) * 0.001;
 
     // If VLC gives us a new time, take that
@@ -468,7 +790,16 @@ float VlcVideoBase::rate()
     double vlcRate = libvlc_media_player_get_rate(player);
     if (!offline)
         lastRate = vlcRate;
-    return vlcRate;
+    return vlcRate / syncNudge;    // The rate of the document
+}
+
+
+float VlcVideoBase::fps()
+// ----------------------------------------------------------------------------
+//   Return frames per second delivered, 0 if unknown or without video
+// ----------------------------------------------------------------------------
+{
+    return 0.0;
 }
 
 
@@ -536,36 +867,73 @@ void VlcVideoBase::setPosition(float pos)
 {
     if (!vlc)
         return;
+    if (syncGroup && syncGroup->started && !offline)
+        syncGroup->anchor(pos * length());
+    if (seekCached(pos * length()))
+        return;
     libvlc_media_player_set_position(player, pos);
+    shownFrame = -1;
     if (!offline)
         lastTime = libvlc_media_player_get_time(player) * 0.001;
+    anchorClock(pos * length());
 }
 
 
 void VlcVideoBase::setTime(float t)
 // ----------------------------------------------------------------------------
-//   Skip to the given time
+//   Skip to the given time, with the whole sync group if any
 // ----------------------------------------------------------------------------
 {
     if (!vlc)
         return;
+    if (syncGroup && syncGroup->started && !offline)
+        syncGroup->anchor(t);
+    seekTo(t);
+}
+
+
+void VlcVideoBase::seekTo(double t)
+// ----------------------------------------------------------------------------
+//   Skip to the given time
+// ----------------------------------------------------------------------------
+{
+    if (seekCached(t))
+        return;
     libvlc_media_player_set_time(player, libvlc_time_t(t * 1000));
+    shownFrame = -1;
     lastTime = frameTime = t;
     if (!offline)
         lastTime = libvlc_media_player_get_time(player) * 0.001;
+    anchorClock(t);
 }
 
 
 void VlcVideoBase::setRate(float rate)
 // ----------------------------------------------------------------------------
-//   Set play rate for the current media
+//   Set play rate for the current media, and for its sync group if any
 // ----------------------------------------------------------------------------
 {
     if (!vlc)
         return;
+    userRate = rate;
+    if (syncGroup && syncGroup->started)
+        syncGroup->setRate(rate);
+    applyRate();
+}
+
+
+void VlcVideoBase::applyRate()
+// ----------------------------------------------------------------------------
+//   Give libVLC the rate of the document, nudged by syncToGroup()
+// ----------------------------------------------------------------------------
+{
+    double rate = userRate * syncNudge;
     libvlc_media_player_set_rate(player, rate);
     if (!offline)
+    {
+        anchorClock(clockTime()); // Time until now was at the old rate
         lastRate = rate;
+    }
 }
 
 
@@ -583,6 +951,96 @@ void VlcVideoBase::setLoop(bool on)
 }
 
 
+double VlcVideoBase::nominalPeriod()
+// ----------------------------------------------------------------------------
+//   Time between frames of the current video track, in s, 0 if unknown
+// ----------------------------------------------------------------------------
+//   libVLC reports the frame rate of tracks since 3.0.
+{
+    double period = 0;
+#if LIBVLC_VERSION_INT >= LIBVLC_VERSION(3, 0, 0, 0)
+    libvlc_media_t *m = libvlc_media_player_get_media(player);
+    if (!m)
+        return 0;
+    libvlc_media_track_t **tracks = NULL;
+    unsigned count = libvlc_media_tracks_get(m, &tracks);
+    int current = libvlc_video_get_track(player);
+    for (unsigned i = 0; i < count; i++)
+    {
+        libvlc_media_track_t *t = tracks[i];
+        if (t->i_type != libvlc_track_video || !t->video->i_frame_rate_num)
+            continue;
+        if (period == 0 || t->i_id == current)
+            period = double(t->video->i_frame_rate_den) /
+                     t->video->i_frame_rate_num;
+    }
+    if (count)
+        libvlc_media_tracks_release(tracks, count);
+    libvlc_media_release(m);
+#endif
+    return period;
+}
+
+
+bool VlcVideoBase::seekFrame(unsigned n)
+// ----------------------------------------------------------------------------
+//   Pause on frame n of the video track
+// ----------------------------------------------------------------------------
+//   The index of the media gives the exact time of each frame. If there is
+//   no keyframe between the frame shown and frame n, stepping forward to n
+//   decodes fewer frames than a seek, which decodes from the keyframe.
+//   Stepping is limited to SEEK_STEPS frames. Local files are indexed in
+//   the background from the first call, or loaded from the cache file of a
+//   previous index. Until the index is ready, or if there is none, frame
+//   times come from the declared frame rate.
+{
+    if (!vlc || state == VS_STOPPED || state == VS_ERROR)
+        return false;
+    if (!index && !mediaName.contains("://"))
+        index = MediaIndex::start(mediaName);
+
+    double t = 0, duration = 0;
+    if (index && index->ready())
+    {
+        if (n >= index->frameCount())
+            return false;
+        t = index->frameTime(n);
+        duration = index->frameDuration(n);
+
+        // Frames replayed from memory are not stepped by libVLC
+        unsigned shown = shownFrame;
+        if (state == VS_PAUSED && shownFrame >= 0 &&
+            n > shown && n - shown <= SEEK_STEPS &&
+            index->keyframe(n) <= shown &&
+            !seekCached(t + duration / 2))
+        {
+            IFTRACE(video)
+                debug() << "Stepping " << n - shown
+                        << " frame(s) to frame " << n << "\n";
+            for (; shown < n; shown++)
+                libvlc_media_player_next_frame(player);
+            shownFrame = n;
+            anchorClock(t);
+            return true;
+        }
+    }
+    else
+    {
+        duration = nominalPeriod();
+        if (duration <= 0)
+            return false;
+        t = n * duration;
+    }
+
+    IFTRACE(video)
+        debug() << "Seeking to frame " << n << " at " << t << " s\n";
+    pause();
+    setTime(t + duration / 2);  // Round to ms within the frame
+    shownFrame = n;
+    return true;
+}
+
+
 std::ostream & VlcVideoBase::debug()
 // ----------------------------------------------------------------------------
 //   Convenience method to log with a common prefix
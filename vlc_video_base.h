@@ -38,6 +38,9 @@
 // *****************************************************************************
 
 #include "tao/tao_gl.h"
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QElapsedTimer>
 #include <QMap>
 #include <QMutex>
 #include <QString>
@@ -50,6 +53,11 @@
 #include <vlc/libvlc_media_player.h>
 #include <iostream>
 
+struct VlcSyncGroup;
+struct MediaIndex;
+class  QObject;
+
+
 struct VlcVideoBase
 // ----------------------------------------------------------------------------
 //   Base class for VLC audio and video streams
@@ -103,6 +111,7 @@ public:
     float          time();
     float          length();
     float          rate();
+    virtual float  fps();
     bool           playing();
     bool           paused();
     bool           done();
@@ -112,16 +121,24 @@ public:
     void           setTime(float pos);
     void           setRate(float pos);
     void           setLoop(bool on);
+    bool           seekFrame(unsigned n);
     QString        url ()   { return mediaName; }
     virtual void   exec();
-    double         updateTime(double frameTime);
+    double         updateTime(double frameTime, double fps);
+    double         clockDrift();
+    void           setSyncGroup(QString name);
+    double         syncOffset()  { return groupOffset; }
+
+public:
+    static void    wakeUp();
+    static void    setWakeUpTarget(QObject *target);
+    static int     wakeUpEvent();
 
 public:
     QString                 lastError;
     double                  lastTime;
     double                  lastRate;
     double                  frameTime;
-    double                  fps;         // -1: not tested, 0: unknown
     bool                    offline;
 
 protected:
@@ -134,25 +151,115 @@ protected:
     libvlc_event_manager_t *pevm;
     bool                    loopMode;
     QVector<char *>         mediaOptions;
+    QMutex                  clockMutex;  // Anchor is set by libVLC events
+    QElapsedTimer           clockAnchor; // When media was at anchorTime
+    double                  anchorTime;  // In s, last reported by libVLC
+    unsigned                driftCount;  // See anchorClock()
+    double                  driftTotal;
+    double                  driftMax;
+    VlcSyncGroup *          syncGroup;   // Videos sharing our clock
+    double                  groupOffset; // Ahead of the group, in s
+    double                  userRate;    // Set by setRate()
+    double                  syncNudge;   // Factor on it, see syncToGroup()
+    bool                    groupHeld;   // Paused until the group starts
+    QElapsedTimer           lastSyncSeek;
+    MediaIndex *            index;       // Frames of local files, or NULL
+    int                     shownFrame;  // Set by seekFrame(), -1: unknown
 
 protected:
+    enum { SYNC_NUDGE_STEPS = 200 };     // Rate nudges are multiples of 1/N
+    enum { SYNC_START_TIMEOUT = 3000 };  // ms members wait for the others
+    enum { SEEK_STEPS = 25 };            // Frames stepped before seeking
+    static const double     SYNC_GAIN;   // Rate change per s of offset
+    static const double     SYNC_MAX_NUDGE;
+    static const double     SYNC_SEEK;   // Seek if offset is larger, in s
+    static QAtomicPointer<QObject> wakeUpTarget;  // Widget to redraw
+    static QAtomicInt       wakeUpPending; // Posted and not drawn yet
+
     void           setState(State state);
+    void           anchorClock(double t, bool measureDrift = false);
+    double         clockTime();
+    double         nominalPeriod();
+    void           syncToGroup();
+    bool           startGroup();
+    void           applyRate();
+    void           seekTo(double t);
     std::ostream & debug();
     void             getMediaSubItems();
     libvlc_media_t * newMediaFromPathOrUrl(QString name);
 
 protected:
     virtual void   startPlayback();
+    virtual bool   seekCached(double t);
 
 protected:
     static void    playerPlaying(const struct libvlc_event_t *, void *obj);
     static void    playerEndReached(const struct libvlc_event_t *, void *obj);
     static void    playerError(const struct libvlc_event_t *, void *obj);
+    static void    playerTimeUpdated(const struct libvlc_event_t *, void *obj);
     static void    mediaSubItemAdded(const struct libvlc_event_t *, void *obj);
 };
 
 
 
+struct VlcSyncGroup
+// ----------------------------------------------------------------------------
+//   Videos following a common clock, e.g. the tiles of a video wall
+// ----------------------------------------------------------------------------
+//   The clock starts once all members play, and stops while none does.
+//   Members adjust their rate to follow it, see VlcVideoBase::syncToGroup().
+{
+    VlcSyncGroup() : origin(0), rate(1.0), started(false) {}
+
+    bool                    running()   { return clock.isValid(); }
+    double                  time()
+    {
+        double t = origin;
+        if (clock.isValid())
+            t += clock.nsecsElapsed() * 1e-9 * rate;
+        return t;
+    }
+    void                    anchor(double t)
+    {
+        origin = t;
+        if (clock.isValid())
+            clock.start();
+    }
+    void                    setRunning(bool on)
+    {
+        if (on == running())
+            return;
+        origin = time();
+        if (on)
+            clock.start();
+        else
+            clock.invalidate();
+    }
+    void                    setRate(double r)
+    {
+        anchor(time());
+        rate = r;
+    }
+    void                    reset()
+    {
+        origin = 0;
+        started = false;
+        clock.invalidate();
+        waiting.invalidate();
+    }
+
+    QList<VlcVideoBase *>   members;
+    QElapsedTimer           clock;      // Invalid while no member plays
+    QElapsedTimer           waiting;    // Since a member waits for others
+    double                  origin;     // Media time when clock started
+    double                  rate;       // Of the clock, see setRate()
+    bool                    started;    // Members started together
+
+    static QMap<QString, VlcSyncGroup *> groups;
+};
+
+
+
 struct AsyncSetVolume : public QThread
 // ----------------------------------------------------------------------------
 //  Singleton for non-blocking (threaded) calls to libvlc_audio_set_volume
@@ -203,13 +310,14 @@ protected:
 };
 
 
-inline double VlcVideoBase::updateTime(double prevTime)
+inline double VlcVideoBase::updateTime(double prevTime, double fps)
 // ----------------------------------------------------------------------------
 //   Update time for the current stream
 // ----------------------------------------------------------------------------
 //   The input prevTime is used in the case of multistream movies.
 //   In that case, we don't know which stream is going to update time first.
-//   So we take as a reference frames that help us make "forward progress"
+//   So we take as a reference frames that help us make "forward progress".
+//   fps is the rate at which the stream delivers frames, 0 if unknown.
 {
     if (fps > 0 && prevTime > 0)
     {
@@ -41,22 +41,20 @@
 #include "tao/tao_gl.h"
 #include "vlc_audio_video.h"
 #include "vlc_video_surface.h"
+#include "vlc_pixel_convert.h"
 #include "base.h"  // IFTRACE()
 #include <QApplication>  // qApp
 #include <QMutexLocker>
+#include <QElapsedTimer>
 #include <vlc/libvlc_events.h>
 #include <vlc/libvlc_media_list.h>
 #include <string.h>
-#ifdef Q_OS_WIN32
-#include <malloc.h>
-#endif
+#include <float.h>
+#include <limits.h>
+#include <math.h>
 
 DLL_PUBLIC Tao::GraphicState * graphic_state = NULL;
 
-// REVISIT: Deprecated, but currently used to set audio delay in PBO case
-extern "C"
-float libvlc_media_player_get_fps( libvlc_media_player_t *p_mi );
-
 
 VlcVideoSurface::VlcVideoSurface(QString mediaNameAndOptions,
                                  unsigned int w, unsigned int h,
@@ -67,14 +65,61 @@ VlcVideoSurface::VlcVideoSurface(QString mediaNameAndOptions,
     : VlcVideoBase(mediaNameAndOptions),
       w(w), h(h), wscale(wscale), hscale(hscale), vtId(-1), nextVtId(0),
       usePBO(QGLFormat::openGLVersionFlags() & QGLFormat::OpenGL_Version_2_1),
-      dropFrames(false)
+      zeroCopy(false),
+      convert(!GLEW_VERSION_1_2),
+      planar(false),
+      earlyConvert(false),
+      adaptive(false), gpuScale(false), threadedUpload(false),
+      cropX(0), cropY(0), cropW(0), cropH(0), renegotiating(NULL),
+      renegotiateShift(0),
+      loopCacheLimit(0), replaying(false), replayTime(0),
+      dropFrames(false), stepping(0), stepPeriod(0), stepOrigin(0),
+      stepTarget(0), stepRequested(0)
 {
     if (getenv("TAO_VLC_NO_PBO"))
         usePBO = false;
     if (!GL.HasBuffers())
         usePBO = false;
+    if (getenv("TAO_VLC_UPLOAD_THREAD") && GLEW_ARB_sync)
+        threadedUpload = VideoUploader::instance() != NULL;
+    if (threadedUpload)
+        usePBO = false; // The uploader thread can afford synchronous uploads
+    if (getenv("TAO_VLC_CONVERT"))
+        convert = true;
+    if (usePBO && !convert && getenv("TAO_VLC_ZERO_COPY"))
+        zeroCopy = GLEW_ARB_buffer_storage && GLEW_ARB_sync;
+    if (getenv("TAO_VLC_YUV"))
+        planar = GLEW_VERSION_2_0 &&
+            (GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object);
+    if (convert || getenv("TAO_VLC_RV32"))
+        planar = false;
+    if (convert && usePBO && !zeroCopy)
+        earlyConvert = getenv("TAO_VLC_RENDER_CONVERT") == NULL;
+    if (w == 0 && h == 0 && wscale == -1.0 && hscale == -1.0)
+        adaptive = getenv("TAO_VLC_ADAPTIVE_SIZE") != NULL;
+    if (!adaptive)
+        gpuScale = getenv("TAO_VLC_GPU_SCALE") != NULL;
     IFTRACE(video)
+    {
         debug() << "Will " << (char*)(usePBO ? "" : "not ") << "use PBOs\n";
+        debug() << "Will " << (char*)(zeroCopy ? "" : "not ")
+                << "decode into mapped buffers\n";
+        debug() << "Will " << (char*)(convert ? "" : "not ")
+                << "convert pictures to GL format\n";
+        debug() << "Will " << (char*)(planar ? "" : "not ")
+                << "accept planar YUV pictures\n";
+        debug() << "Will " << (char*)(adaptive ? "" : "not ")
+                << "adapt decoded size to size on screen\n";
+        debug() << "Will " << (char*)(gpuScale ? "" : "not ")
+                << "scale textures on the GPU\n";
+        debug() << "Will " << (char*)(threadedUpload ? "" : "not ")
+                << "upload textures in a separate thread\n";
+        if (convert)
+            debug() << "Will convert pictures in the "
+                    << (char*)(earlyConvert ? "libVLC" : "render")
+                    << " thread\n";
+        debug() << "Pixel conversion kernel: " << pixelConvertKernel() << "\n";
+    }
 }
 
 
@@ -101,52 +146,33 @@ void VlcVideoSurface::stop()
         t->stop();
 
     // videoFormat() callback will be called again if playback is resumed
+    renegotiating = NULL;
+    replaying = false;
     vtId = -1;
     nextVtId = 0;
 }
 
 
-// This is actually deprecated now
-LIBVLC_API float libvlc_media_player_get_fps( libvlc_media_player_t *p_mi );
-
-
 void VlcVideoSurface::exec()
 // ----------------------------------------------------------------------------
 //   Run state machine in main thread
 // ----------------------------------------------------------------------------
 {
+    if (stepping.load() && (!offline || replaying))
+        stopStepping();
+    if (state == VS_PLAY_ENDED && loopMode && loopCacheLimit)
+        startReplay();
+    if (replaying)
+        replay();
+
     switch (state)
     {
     case VS_PLAYING:
-        // REVISIT: this cannot make sense when media has multiple streams
-        if (usePBO && fps == -1.0)
-        {
-            fps = libvlc_media_player_get_fps(player);
-            if (usePBO)
-            {
-                if (fps)
-                {
-                    int64_t delay = 1000000/fps;
-                    IFTRACE(video)
-                    {
-                        debug() << "FPS: " << fps << "\n";
-                        debug() << "Compensating for PBO ping-pong delay: "
-                                << delay << " us\n";
-                    }
-                    libvlc_audio_set_delay(player, delay);
-                }
-                else
-                {
-                    IFTRACE(video)
-                        debug() << "Unknown FPS - "
-                                   "won't compensate for PBO ping-pong delay\n";
-                }
-            }
-        }
-        // FALL THROUGH
     case VS_PAUSED:
     case VS_PLAY_ENDED:
         updateTexture();
+        if (adaptive && !replaying)
+            adaptSize();
         break;
 
     default:
@@ -157,6 +183,319 @@ void VlcVideoSurface::exec()
 }
 
 
+void VlcVideoSurface::adaptSize()
+// ----------------------------------------------------------------------------
+//   Restart video output if decoded size does not match size on screen
+// ----------------------------------------------------------------------------
+{
+    VideoTrack *t = currentVideoTrack();
+    if (!t || renegotiationPending() || videoTracks.size() != 1)
+        return;
+
+    int shift = t->adaptShift();
+    if (shift < 0)
+        return;
+
+    IFTRACE(video)
+        debug() << "Decoded size " << t->w << "x" << t->h
+                << " does not fit size on screen, will decode at 1/"
+                << (1 << shift) << "\n";
+    mutex.lock();
+    renegotiateShift = t->decodeShift;
+    t->decodeShift = shift;
+    mutex.unlock();
+    if (!restartVideo(t))
+    {
+        mutex.lock();
+        t->decodeShift = renegotiateShift;
+        mutex.unlock();
+    }
+}
+
+
+bool VlcVideoSurface::restartVideo(VideoTrack *t)
+// ----------------------------------------------------------------------------
+//   Have libVLC call videoFormat() again for track t
+// ----------------------------------------------------------------------------
+//   libVLC only calls videoFormat() when the video output starts, so we
+//   disable and re-enable the video track. The track then gets new frames
+//   after the next keyframe, and keeps its textures and statistics.
+{
+    if (replaying)
+        return false;           // libVLC is not playing anymore
+    int track = libvlc_video_get_track(player);
+    if (track < 0)
+        return false;
+
+    mutex.lock();
+    renegotiating = t;
+    renegotiateClock.start();
+    mutex.unlock();
+    libvlc_video_set_track(player, -1);
+    libvlc_video_set_track(player, track);
+    return true;
+}
+
+
+bool VlcVideoSurface::renegotiationPending()
+// ----------------------------------------------------------------------------
+//   Return true while waiting for the videoFormat() call of restartVideo()
+// ----------------------------------------------------------------------------
+//   If libVLC reuses the video output, that call never comes. After a
+//   while, give up so that the size can be adapted again. The decoded size
+//   did not change, so neither does decodeShift. If the call comes later
+//   anyway, videoFormat() still reuses the track in 'renegotiating'.
+{
+    QMutexLocker locker(&mutex);
+    if (!renegotiating || !renegotiateClock.isValid())
+        return false;
+    if (renegotiateClock.elapsed() < RENEGOTIATE_TIMEOUT)
+        return true;
+
+    IFTRACE(video)
+        debug() << "No new video format after " << RENEGOTIATE_TIMEOUT
+                << " ms, giving up\n";
+    renegotiating->decodeShift = renegotiateShift;
+    renegotiateClock.invalidate();
+    return false;
+}
+
+
+bool VlcVideoSurface::startReplay()
+// ----------------------------------------------------------------------------
+//   At the end of a pass, replay the cached frames instead of decoding
+// ----------------------------------------------------------------------------
+//   The current track starts recording when it has no cache yet: the pass
+//   that libVLC is about to start is then the first one. Sound, if any, is
+//   not replayed.
+{
+    VideoTrack *t = currentVideoTrack();
+    if (!t || videoTracks.size() != 1 || zeroCopy)
+        return false;
+    if (!t->loopCache)
+    {
+        t->loopCache = new FrameCache(loopCacheLimit);
+        return false;
+    }
+    if (!t->loopCache->finish())
+        return false;
+
+    IFTRACE(video)
+        debug() << "Loop mode: replaying " << t->loopCache->count()
+                << " cached frames\n";
+    replaying = true;
+    replayTime = 0;
+    replayClock.start();
+    t->replayed = -1;
+    setState(VS_PLAYING);
+    return true;
+}
+
+
+void VlcVideoSurface::replay()
+// ----------------------------------------------------------------------------
+//   Show the cached frame for the current time, following pause and rate
+// ----------------------------------------------------------------------------
+{
+    qint64 elapsed = replayClock.restart();
+    VideoTrack *t = currentVideoTrack();
+    if (!t || !t->loopCache)
+    {
+        replaying = false;
+        return;
+    }
+    if (state == VS_PLAYING)
+    {
+        replayTime += elapsed * lastRate;
+        anchorClock(fmod(replayTime, t->loopCache->duration()) * 0.001);
+    }
+
+    // Loop mode was disabled: end after the pass being replayed
+    if (!loopMode && replayTime >= t->loopCache->duration())
+    {
+        replaying = false;
+        setState(VS_PLAY_ENDED);
+        return;
+    }
+    t->replayFrame(qint64(replayTime));
+    wakeUp();                   // No libVLC frame will, see replayFrame()
+}
+
+
+bool VlcVideoSurface::seekCached(double t)
+// ----------------------------------------------------------------------------
+//   While replaying, seek in the cached frames
+// ----------------------------------------------------------------------------
+//   libVLC is stopped during replay, and would ignore the seek. Passes
+//   already replayed are kept, so that replay() still ends after the
+//   current pass if loop mode was disabled.
+{
+    VideoTrack *tr = currentVideoTrack();
+    if (!replaying || !tr || !tr->loopCache)
+        return false;
+
+    double duration = tr->loopCache->duration();
+    double ms = qBound(0.0, t * 1000, duration - 1);
+    replayTime = floor(replayTime / duration) * duration + ms;
+    shownFrame = -1;
+    lastTime = frameTime = ms * 0.001;
+    anchorClock(ms * 0.001);
+    tr->replayFrame(qint64(replayTime));
+    wakeUp();
+    return true;
+}
+
+
+bool VlcVideoSurface::stepTo(double t)
+// ----------------------------------------------------------------------------
+//   Offline rendering: wait until the frame at media time t was decoded
+// ----------------------------------------------------------------------------
+//   The player is paused, and frames are asked one at a time with
+//   libvlc_media_player_next_frame(), up to QUEUE_SIZE ahead, and stamped
+//   with their media time, see steppedFrameTime(). While t moves forward,
+//   there is no seek, and the frame shown does not depend on how long
+//   rendering takes. Return false if this is not possible, e.g. while the video
+//   starts or if its frame rate is unknown: the caller then seeks.
+{
+    VideoTrack *tr = currentVideoTrack();
+    if (!tr || videoTracks.size() != 1 || threadedUpload || replaying)
+        return false;
+    bool stepped = stepping.load();
+    if (stepped && state == VS_PLAY_ENDED)
+        return true;            // Keep the last frame
+    if (state != VS_PLAYING && state != VS_PAUSED)
+        return false;
+    if (!stepped)
+    {
+        stepPeriod = nominalPeriod();
+        if (stepPeriod <= 0)
+            return false;
+    }
+    if (!stepped || state == VS_PLAYING ||
+        t < stepTarget || t > stepTarget + STEP_SEEK * 0.001)
+        startStepping(t);
+    stepTarget = t;
+
+    qint64 target = qint64(t * 1e9);
+    QElapsedTimer timer;
+    timer.start();
+    QMutexLocker locker(&stepMutex);
+    requestSteps(tr);
+    while (!tr->hasFrameAt(target) && state == VS_PAUSED && lastError == "")
+    {
+        qint64 left = STEP_TIMEOUT - timer.elapsed();
+        if (left <= 0)
+        {
+            IFTRACE(video)
+                debug() << "Offline: no frame at " << t << " s after "
+                        << STEP_TIMEOUT << " ms\n";
+            stepRequested = 0;  // Asked again next time
+            break;
+        }
+        // Wake up now and then to notice the end of the media
+        stepReady.wait(&stepMutex, qMin(left, qint64(STEP_SLICE)));
+        requestSteps(tr);
+    }
+    return true;
+}
+
+
+void VlcVideoSurface::startStepping(double t)
+// ----------------------------------------------------------------------------
+//   Pause and seek to t. Frames then come one by one, see stepTo()
+// ----------------------------------------------------------------------------
+//   libVLC seeks asynchronously, so a frame decoded before the seek may
+//   still arrive. It has an earlier media time, and hasFrameAt() drops it.
+{
+    IFTRACE(video)
+        debug() << "Offline: stepping from " << t << " s at "
+                << 1 / stepPeriod << " frames per second\n";
+    pause();
+    setTime(t);
+
+    stepMutex.lock();
+    stepping.storeRelease(1);
+    stepOrigin = t;
+    stepRequested = 0;
+    stepMutex.unlock();
+
+    VideoTrack *tr = currentVideoTrack();
+    tr->mutex.lock();
+    tr->dropQueuedFrames();
+    tr->shownTime = -1;
+    tr->mutex.unlock();
+}
+
+
+void VlcVideoSurface::stopStepping()
+// ----------------------------------------------------------------------------
+//   Resume playing in real time, e.g. when offline rendering ends
+// ----------------------------------------------------------------------------
+{
+    IFTRACE(video)
+        debug() << "Offline: stop stepping at " << stepTarget << " s\n";
+    stepMutex.lock();
+    stepping.storeRelease(0);
+    stepRequested = 0;
+    stepMutex.unlock();
+
+    if (VideoTrack *tr = currentVideoTrack())
+    {
+        tr->mutex.lock();
+        tr->dropQueuedFrames();
+        tr->mutex.unlock();
+    }
+    if (state == VS_PAUSED)
+        play();
+}
+
+
+void VlcVideoSurface::requestSteps(VideoTrack *t)
+// ----------------------------------------------------------------------------
+//   Decode ahead: ask frames until they would fill the queue of t
+// ----------------------------------------------------------------------------
+//   Called with stepMutex locked.
+{
+    int queued = t->queueTail.loadAcquire() - t->queueHead.loadAcquire();
+    while (queued + int(stepRequested) < VideoTrack::QUEUE_SIZE)
+    {
+        libvlc_media_player_next_frame(player);
+        stepRequested++;
+    }
+}
+
+
+qint64 VlcVideoSurface::steppedFrameTime()
+// ----------------------------------------------------------------------------
+//   libVLC thread: count a frame that was asked, return its media time in ns
+// ----------------------------------------------------------------------------
+//   While paused, the player time is that of the frame being displayed.
+//   libVLC reports it in ms, so it is rounded to the frames from stepOrigin.
+//   Counting arrivals instead would shift every frame after a lost one.
+{
+    double t = libvlc_media_player_get_time(player) * 0.001;
+    QMutexLocker locker(&stepMutex);
+    if (stepRequested)
+        stepRequested--;
+    if (stepPeriod > 0)
+    {
+        double n = floor((t - stepOrigin) / stepPeriod + 0.5);
+        t = stepOrigin + n * stepPeriod;
+    }
+    return qint64(t * 1e9);
+}
+
+
+void VlcVideoSurface::steppedFrameQueued()
+// ----------------------------------------------------------------------------
+//   libVLC thread: wake up stepTo()
+// ----------------------------------------------------------------------------
+{
+    QMutexLocker locker(&stepMutex);
+    stepReady.wakeAll();
+}
+
+
 void VlcVideoSurface::startPlayback()
 // ----------------------------------------------------------------------------
 //   Bind vmem callbacks to player and start playback
@@ -172,9 +511,12 @@ void VlcVideoSurface::startPlayback()
     // (approximately) at start-time.
     // With this code I could get rid of the unwanted pictures with all the
     // videos I tested.
+    bool desync = false;
     foreach(char *opt, mediaOptions)
     {
         QString option(opt);
+        if (option.startsWith("audio-desync="))
+            desync = true;
         if (option.startsWith("start-time="))
         {
             bool ok = false;
@@ -195,6 +537,15 @@ void VlcVideoSurface::startPlayback()
         }
     }
 
+    // Frames are shown PRESENT_DELAY after they arrive, see takeFrame():
+    // delay the audio as much, unless the document chose another delay
+    if (!threadedUpload && !desync)
+    {
+        QByteArray delay = QString(":audio-desync=%1")
+            .arg(int(PRESENT_DELAY)).toUtf8();
+        libvlc_media_add_option(media, delay.constData());
+    }
+
     VlcVideoBase::startPlayback();
 }
 
@@ -211,6 +562,78 @@ std::ostream & VlcVideoSurface::debug()
 }
 
 
+static const char *chromaName[] = { "", "RV32", "UYVY", "I420", "NV12" };
+
+
+static bool isYUV420(const char *chroma)
+// ----------------------------------------------------------------------------
+//   Check if a libVLC chroma is YUV 4:2:0, i.e. can be decoded as I420/NV12
+// ----------------------------------------------------------------------------
+{
+    static const char *yuv420[] =
+    {
+        "I420", "J420", "YV12", "IYUV", "NV12", "NV21", "I0AL", "P010"
+    };
+    for (unsigned i = 0; i < sizeof(yuv420) / sizeof(yuv420[0]); i++)
+        if (strncmp(chroma, yuv420[i], 4) == 0)
+            return true;
+    return false;
+}
+
+
+void VlcVideoSurface::colorimetry(int es_id, unsigned height,
+                                  const char *chroma,
+                                  bool *bt709, bool *fullRange)
+// ----------------------------------------------------------------------------
+//   YUV matrix and range of video track es_id, from its metadata if possible
+// ----------------------------------------------------------------------------
+//   libVLC 3 describes tracks without their matrix or range. What it gives
+//   is the coded height and the codec, which feed the usual rules: HD is
+//   BT.709, SD is BT.601, and only JPEG is full range. Without metadata,
+//   e.g. before the media was parsed, the decoded height and chroma are used.
+{
+    *bt709 = height > 576;
+    *fullRange = chroma[0] == 'J';
+
+#if LIBVLC_VERSION_INT >= LIBVLC_VERSION(3, 0, 0, 0)
+    libvlc_media_t *m = libvlc_media_player_get_media(player);
+    if (!m)
+        return;
+    libvlc_media_track_t **tracks = NULL;
+    unsigned count = libvlc_media_tracks_get(m, &tracks);
+    libvlc_media_track_t *found = NULL;
+    for (unsigned i = 0; i < count; i++)
+    {
+        libvlc_media_track_t *t = tracks[i];
+        if (t->i_type != libvlc_track_video)
+            continue;
+        if (!found || t->i_id == es_id)
+            found = t;
+    }
+    if (found)
+    {
+        // Codecs are little-endian fourccs, e.g. 'MJPG'
+        static const char *jpeg[] = { "MJPG", "mjpg", "jpeg", "JPEG" };
+        char codec[4];
+        for (unsigned i = 0; i < 4; i++)
+            codec[i] = char(found->i_codec >> (8 * i));
+        if (found->video->i_height)
+            *bt709 = found->video->i_height > 576;
+        for (unsigned i = 0; i < sizeof(jpeg) / sizeof(jpeg[0]); i++)
+            if (strncmp(codec, jpeg[i], 4) == 0)
+                *fullRange = true;
+        IFTRACE(video)
+            debug() << "Track " << found->i_id << " codec "
+                    << std::string(codec, 4) << ", coded height "
+                    << found->video->i_height << "\n";
+    }
+    if (count)
+        libvlc_media_tracks_release(tracks, count);
+    libvlc_media_release(m);
+#endif
+}
+
+
 unsigned VlcVideoSurface::videoFormat(void **opaque, char *chroma,
                                       unsigned *width, unsigned *height,
                                       unsigned *pitches,
@@ -229,21 +652,56 @@ unsigned VlcVideoSurface::videoFormat(void **opaque, char *chroma,
 
     // When there are multiple video streams in the container, this function is
     // called once per stream from multiple threads
-    QMutexLocker(&s->mutex);
+    QMutexLocker locker(&s->mutex);
 
     IFTRACE(video)
         s->debug() << "Stream " << es_id << " native video format: "
                    << *width << "x" << *height << " chroma "
                    << chroma << "\n";
 
-    int id = s->newTrack(es_id);
-    if (id < 0)
-        return 0;
+    // A track restarted by restartVideo() keeps its textures and statistics
+    VideoTrack *v = s->renegotiating;
+    s->renegotiating = NULL;
+    if (!v)
+    {
+        int id = s->newTrack(es_id);
+        if (id < 0)
+            return 0;
+        v = s->videoTracks[id];
+    }
 
+    // libVLC does not give us the colorimetry here, ask the track
+    bool bt709, fullRange;
+    s->colorimetry(es_id, *height, chroma, &bt709, &fullRange);
 
-    VideoTrack *v = s->videoTracks[id];
+    // With GPU scaling, decode at native size and let texture filtering
+    // (and mipmaps when shrinking) produce the size asked for
+    v->gpuScale = false;
+    unsigned nativeW = *width, nativeH = *height;
+    if (!s->adaptive)
+    {
+        // Size asked by the document, which may be renegotiated
+        v->w = v->requestW;
+        v->h = v->requestH;
+    }
 
-    if (v->wscale != -1.0 && v->hscale != 1.0)
+    if (s->adaptive)
+    {
+        // Decode at 1/2, 1/4 or 1/8 of the size if that's enough on screen
+        v->displayW = v->w = *width;
+        v->displayH = v->h = *height;
+        if (v->decodeShift)
+        {
+            v->w = qMax(*width  >> v->decodeShift, 2u) & ~1u;
+            v->h = qMax(*height >> v->decodeShift, 2u) & ~1u;
+            *width  = v->w;
+            *height = v->h;
+        }
+        IFTRACE(video)
+            s->debug() << "Adaptive size: decoding at "
+                       << v->w << "x" << v->h << "\n";
+    }
+    else if (v->wscale != -1.0 && v->hscale != 1.0)
     {
         IFTRACE(video)
             v->debug() << "Relative texture size requested: ("
@@ -252,7 +710,19 @@ unsigned VlcVideoSurface::videoFormat(void **opaque, char *chroma,
         v->w = *width  * v->wscale;
         v->h = *height * v->hscale;
     }
-    if (v->w == 0 && v->h == 0)
+    if (!s->adaptive && s->gpuScale && v->w && v->h)
+    {
+        v->gpuScale = true;
+        v->displayW = v->w;
+        v->displayH = v->h;
+        v->w = *width;
+        v->h = *height;
+        IFTRACE(video)
+            s->debug() << "GPU scaling: texture size " << v->w << "x" << v->h
+                       << " shown as " << v->displayW << "x" << v->displayH
+                       << "\n";
+    }
+    else if (v->w == 0 && v->h == 0)
     {
         v->w = *width;
         v->h = *height;
@@ -268,32 +738,54 @@ unsigned VlcVideoSurface::videoFormat(void **opaque, char *chroma,
             s->debug() << "Requesting libVLC scaling to texture size: "
                        << v->w << "x" << v->h << "\n";
     }
+    if (!s->adaptive && !v->gpuScale)
+    {
+        v->displayW = v->w;
+        v->displayH = v->h;
+    }
 
-    const char * newchroma;
-
+    VideoTrack::Chroma newchroma = VideoTrack::RV32;
+    if (s->planar && isYUV420(chroma))
+    {
+        // Let the GPU convert YUV, and upload 1.5 bytes per pixel
+        newchroma = strncmp(chroma, "NV12", 4) ? VideoTrack::I420
+                                               : VideoTrack::NV12;
+    }
 #if defined(Q_OS_MACX)
-    bool useUYVY = (getenv("TAO_VLC_RV32") == NULL);
-    if (useUYVY)
+    else if (getenv("TAO_VLC_RV32") == NULL)
     {
-        newchroma = "UYVY";
-        v->image.chroma = VideoTrack::UYVY;
-        pitches[0] = pitches[1] = pitches[2] = v->w * 2;
-        lines  [0] = lines  [1] = lines  [2] = v->h;
-        v->image.size = v->w * v->h * 2;
+        newchroma = VideoTrack::UYVY;
     }
-    else
 #endif
+    bool mipmaps = v->gpuScale && (v->displayW < nativeW ||
+                                v->displayH < nativeH) &&
+        (GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object);
+    v->setFormat(newchroma, bt709, fullRange, mipmaps);
+
+    for (unsigned p = 0; p < 3; p++)
     {
-        newchroma = "RV32";
-        v->image.chroma = VideoTrack::RV32;
-        pitches[0] = pitches[1] = pitches[2] = v->w * 4;
-        lines  [0] = lines  [1] = lines  [2] = v->h;
-        v->image.size = v->w * v->h * 4;
+        // Packed chromas repeat plane 0, unused planes are left empty
+        bool planar = v->layout.planes > 1;
+        VideoTrack::Plane &plane = v->layout.plane[planar ? p : 0];
+        bool used = !planar || p < v->layout.planes;
+        pitches[p] = used ? plane.pitch  : 0;
+        lines  [p] = used ? plane.height : 0;
     }
+    // With zero-copy, the render thread gives the pool a mapped buffer
+    // large enough for the new size, see VideoTrack::transferMapped()
+    v->pool.configure(v->layout.size,
+                      v->zeroCopy ? 0 : VideoTrack::FRAME_COUNT);
+    if (!v->keepsFrames())
+        v->staging.configure(v->layout.size, VideoTrack::QUEUE_SIZE + 2);
 
     IFTRACE(video)
-        s->debug() << "Requesting " << newchroma << " chroma\n";
-    strcpy(chroma, newchroma);
+    {
+        s->debug() << "Requesting " << chromaName[newchroma] << " chroma\n";
+        if (v->layout.planes > 1)
+            s->debug() << "Color conversion: " << (bt709 ? "BT.709" : "BT.601")
+                       << (fullRange ? ", full range\n" : ", limited range\n");
+    }
+    strcpy(chroma, chromaName[newchroma]);
 
     *opaque = (void *)v;
     return 1;
@@ -336,6 +828,85 @@ bool VlcVideoSurface::setVideoTrack(int id)
 }
 
 
+void VlcVideoSurface::setRegion(float x, float y, float w, float h)
+// ----------------------------------------------------------------------------
+//   Only show (and upload) a rectangle of the video, in pixels
+// ----------------------------------------------------------------------------
+//   x, y is the top left corner. The whole video is shown if w or h is 0.
+{
+    if (w <= 0 || h <= 0)
+        x = y = w = h = 0;
+    cropX = x;
+    cropY = y;
+    cropW = w;
+    cropH = h;
+    foreach(VideoTrack *t, videoTracks)
+        t->setRegion(x, y, w, h);
+}
+
+
+void VlcVideoSurface::setGpuScaling(bool on)
+// ----------------------------------------------------------------------------
+//   Choose between libVLC and GPU scaling for textures of a given size
+// ----------------------------------------------------------------------------
+//   The video output is restarted so that videoFormat() applies the choice.
+//   Adaptive decoding already picks the decoded size, so it ignores this.
+{
+    if (adaptive || on == gpuScale)
+        return;
+    gpuScale = on;
+    IFTRACE(video)
+        debug() << "Will " << (char*)(gpuScale ? "" : "not ")
+                << "scale textures on the GPU\n";
+    VideoTrack *t = currentVideoTrack();
+    if (t && !renegotiationPending() && videoTracks.size() == 1)
+    {
+        renegotiateShift = t->decodeShift;
+        restartVideo(t);
+    }
+}
+
+
+void VlcVideoSurface::setLoopCache(unsigned megabytes)
+// ----------------------------------------------------------------------------
+//   Record the first pass of a looping video, and replay it from memory
+// ----------------------------------------------------------------------------
+//   Recording starts with the next pass, and is abandoned if the frames
+//   need more than 'megabytes'. 0 disables the cache.
+{
+    loopCacheLimit = size_t(megabytes) * 1024 * 1024;
+    IFTRACE(video)
+        debug() << "Loop cache limit: " << megabytes << " MB"
+                << (zeroCopy ? ", ignored with mapped buffers\n" : "\n");
+    if (!loopCacheLimit && replaying)
+    {
+        // Let VlcVideoBase::exec() restart playback with libVLC
+        replaying = false;
+        setState(VS_PLAY_ENDED);
+    }
+}
+
+
+float VlcVideoSurface::fps()
+// ----------------------------------------------------------------------------
+//   Frame rate measured on the current video track
+// ----------------------------------------------------------------------------
+{
+    VideoTrack *t = currentVideoTrack();
+    return t ? t->fps() : 0.0;
+}
+
+
+double VlcVideoSurface::uploadTime()
+// ----------------------------------------------------------------------------
+//   CPU time to convert and upload a frame of the current track, in us
+// ----------------------------------------------------------------------------
+{
+    VideoTrack *t = currentVideoTrack();
+    return t ? t->frameCost() : 0.0;
+}
+
+
 unsigned VlcVideoSurface::width()
 // ----------------------------------------------------------------------------
 //   Return width of current video track in pixels
@@ -402,23 +973,73 @@ int VlcVideoSurface::newTrack(int es_id)
 //
 // ============================================================================
 
+struct MonotonicClock
+// ----------------------------------------------------------------------------
+//   Time frames arrive and textures are drawn, started at load time
+// ----------------------------------------------------------------------------
+{
+    MonotonicClock() { timer.start(); }
+    QElapsedTimer timer;
+};
+
+static MonotonicClock monotonicClock;
+
+
+static inline qint64 monotonicTime()
+// ----------------------------------------------------------------------------
+//   Nanoseconds since the module was loaded, never going backwards
+// ----------------------------------------------------------------------------
+{
+    return monotonicClock.timer.nsecsElapsed();
+}
+
+
+static inline qint64 averagePeriod(qint64 period, qint64 &last, qint64 now)
+// ----------------------------------------------------------------------------
+//   Moving average of the interval between events, ignoring pauses
+// ----------------------------------------------------------------------------
+{
+    qint64 interval = now - last;
+    last = now;
+    if (interval < 1000000 || interval > 1000000000)
+        return period;          // Same render, or not playing
+    return period ? period + (interval - period) / 8 : interval;
+}
+
+
 VideoTrack::VideoTrack(VlcVideoSurface *parent, unsigned id)
 // ----------------------------------------------------------------------------
 //   Individual video track in a multistream file
 // ----------------------------------------------------------------------------
     : parent(parent), id(id),
-      w(parent->w), h(parent->h),
+      w(parent->w), h(parent->h), requestW(w), requestH(h),
       wscale(parent->wscale), hscale(parent->hscale),
-      textureId(0),
-      updated(false),
-      videoAvailable(false), videoAvailableInTexture(false),
-      usePBO(parent->usePBO),
+      displayW(w), displayH(h), decodeShift(0), adaptFrames(0),
+      projectedW(0), projectedH(0),
+      cropX(parent->cropX), cropY(parent->cropY),
+      cropW(parent->cropW), cropH(parent->cropH),
+      res(NULL), back(0), ready(-1), readyFence(0), uploadStorage(0),
+      ringExhausted(0),
+      gpuScale(false),
+      queueHead(0), queueTail(0), lastArrival(0), framePeriod(0),
+      lastRender(0), renderPeriod(0), shownTime(0),
+      superseded(0), repeated(0),
+      frameSeq(0), videoAvailableInTexture(false),
+      usePBO(parent->usePBO), zeroCopy(parent->zeroCopy),
+      convert(parent->convert), earlyConvert(parent->earlyConvert),
+      threadedUpload(parent->threadedUpload),
+      native(false),
       GLcontext(NULL),
-      curPBO(0), curPBOPtr(NULL), refs(1), frameTime(-1)
+      pboWaits(0),
+      mappedBuffer(0), mappedBase(NULL), mappedStride(0),
+      mappedContext(NULL),
+      loopCache(NULL), replayed(-1),
+      refs(1), frameTime(-1)
 {
     IFTRACE(video)
         debug() << "Creation\n";
-    pbo[0] = pbo[1] = 0;
+    memset(&roi, 0, sizeof(roi));
+    retired.reserve(FramePool::DEFAULT_COUNT);
     // Note: initialization of GL resource is left to checkGLContext()
     // because this constructor is usually not called from the main thread
 }
@@ -429,24 +1050,48 @@ VideoTrack::~VideoTrack()
 //    Video track destructor
 // ----------------------------------------------------------------------------
 {
-    IFTRACE(video)
-        debug() << "Deleting texture\n";
+    // The uploader thread may be working on this track, wait for it
+    if (threadedUpload)
+        VideoUploader::discard(this);
 
-    if (textureId)
-        GL.DeleteTextures(1, &textureId);
-
-    if (usePBO)
-    {
-        IFTRACE(video)
-            debug() << "Deleting PBOs\n";
-        GL.DeleteBuffers(2, pbo);
-    }
+    IFTRACE(video)
+        debug() << "Deleting GL objects of " << contexts.size()
+                << " context(s), ring ran out " << ringExhausted
+                << " time(s), " << pboWaits
+                << " frame(s) delayed by busy PBOs\n";
+    foreach (const QGLContext *context, contexts.keys())
+        releaseContext(context, false);
+
+    deleteMappedBuffer();
+
+    // The last frames received from libVLC, or converted from them, are ours
+    dropFrame(image.ptr);
+    dropQueuedFrames();
+    foreach (void *frame, retired)
+        freeFrame(frame);
+    delete loopCache;
 
     IFTRACE(video)
-        if (!allocatedFrames.empty())
-            debug() << "Freeing " << allocatedFrames.size() << " frame(s)\n";
-    foreach (void *frame, allocatedFrames)
-        freeFrame(frame);
+        debug() << "Frame pool: " << pool.hits() << " hit(s), "
+                << pool.misses() << " miss(es), high-water mark "
+                << pool.highWater() << ", " << pool.inUse()
+                << " frame(s) still in use, " << superseded.load()
+                << " frame(s) skipped, " << repeated
+                << " render(s) repeating a frame\n";
+    IFTRACE(video)
+        debug() << "Conversion: " << convertTiming.average() << " us for "
+                << convertTiming.count << " frame(s), "
+                << (zeroCopy ? "mapped" : usePBO ? "PBO" :
+                    threadedUpload ? "threaded" : "no PBO")
+                << " upload: " << uploadTiming.average() << " us for "
+                << uploadTiming.count << " frame(s)\n";
+    IFTRACE(video)
+        debug() << "Scaling: " << w << "x" << h << " texture shown as "
+                << displayW << "x" << displayH
+                << (w == displayW && h == displayH ? "" :
+                    gpuScale ? " by the GPU" : " by libVLC")
+                << (image.mipmaps ? " with mipmaps" : "") << ", "
+                << frameCost() << " us per frame\n";
 }
 
 
@@ -495,86 +1140,244 @@ void VideoTrack::Draw()
 //   Draw video texture
 // ----------------------------------------------------------------------------
 {
-    // Bind Texture
+    // Drawn in another context than the one of the last update
+    if (!threadedUpload && QGLContext::currentContext() != GLcontext)
+        updateTexture();
+
+    // Bind the newest texture, and remember the GPU may be reading it
+    GLuint id = texture();
+    GLResources *g = ring();
+    if (id)
+        g->textures[g->front].drawn = true;
+    if (id && isPlanar() && !convertYuv())
+        id = 0;
+    if (parent->adaptive)
+        projectSize();
     GL.Enable(GL_TEXTURE_2D);
-    GL.BindTexture(GL_TEXTURE_2D, texture());
+    GL.BindTexture(GL_TEXTURE_2D, id);
+
+    // A region of the video is at the bottom left of the texture
+    unsigned fw = image.plane[0].width, fh = image.plane[0].height;
+    Region r = { 0, 0, fw, fh };
+    if (id)
+        r = g->textures[g->front].region;
+    bool cropped = r.width && r.height && (r.width != fw || r.height != fh);
+
+    if (native || cropped)
+    {
+        GL.MatrixMode(GL_TEXTURE);
+        if (cropped)
+            GL.Scale(double(r.width) / fw, double(r.height) / fh, 1.0);
+        if (native)
+        {
+            // Pictures from libVLC have their top row first: flip the
+            // texture coordinates of the shapes that follow in this layout
+            GL.Translate(0.0, 1.0, 0.0);
+            GL.Scale(1.0, -1.0, 1.0);
+        }
+        GL.MatrixMode(GL_MODELVIEW);
+    }
 
     // We don't want to use Tao preferences so we
     // have to set texture settings
+    GLenum minFilter = image.mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR;
     GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
 }
 
 
-#if defined(Q_OS_MACX)
-static void verticalFlip16(void *to, const void *from, int w, int h)
+bool VideoTrack::convertYuv()
 // ----------------------------------------------------------------------------
-//   Flip 16-bit image vertically
+//   Planar pictures: draw the planes of the front texture into rgbTexture
 // ----------------------------------------------------------------------------
+//   The texture of the video is then RGB as with packed chromas, so that
+//   shaders and texture units of the document work the same. This renders
+//   into a framebuffer object with the YUV shader, and restores the program,
+//   framebuffer, texture units, matrices and enables it changed. Tao's GL
+//   state cache is bypassed, since everything is restored.
 {
-    // Adapted from Qt source code: qimage.cpp
-    // (License: LGPL)
+    if (!res->yuvShaderReady || !res->yuvShader)
+        return false;
+    GLResources *g = ring();
+    Texture &t = g->textures[g->front];
+    unsigned fw = image.plane[0].width, fh = image.plane[0].height;
+
+    GLint program = 0, framebuffer = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+    glPushAttrib(GL_ENABLE_BIT | GL_VIEWPORT_BIT | GL_TEXTURE_BIT |
+                 GL_TRANSFORM_BIT | GL_CURRENT_BIT);
+
+    glActiveTexture(GL_TEXTURE0);
+    if (!res->rgbFramebuffer)
+        glGenFramebuffers(1, &res->rgbFramebuffer);
+    if (!res->rgbValid)
+    {
+        GLenum minFilter = image.mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR;
+        glBindTexture(GL_TEXTURE_2D, res->rgbTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, fw, fh, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+        res->rgbValid = true;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, res->rgbFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, res->rgbTexture, 0);
+    bool ok = (glCheckFramebufferStatus(GL_FRAMEBUFFER) ==
+               GL_FRAMEBUFFER_COMPLETE);
+    if (ok)
+    {
+        static const GLenum disabled[] = {
+            GL_BLEND, GL_DEPTH_TEST, GL_STENCIL_TEST, GL_SCISSOR_TEST,
+            GL_ALPHA_TEST, GL_CULL_FACE, GL_LIGHTING
+        };
+        for (unsigned i = 0; i < sizeof(disabled)/sizeof(*disabled); i++)
+            glDisable(disabled[i]);
+        glViewport(0, 0, fw, fh);
+
+        // Y in unit 0, chroma in units 1 and 2, as set by setYuvUniforms()
+        for (unsigned p = 0; p < image.planes; p++)
+        {
+            glActiveTexture(GL_TEXTURE0 + p);
+            glBindTexture(GL_TEXTURE_2D, t.planes[p]);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+                            GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+                            GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        }
+        glActiveTexture(GL_TEXTURE0);
+        glUseProgram(res->yuvShader->programId());
+
+        // Texel for texel: the RGB texture has the layout of the planes
+        GLenum matrices[] = { GL_PROJECTION, GL_MODELVIEW, GL_TEXTURE };
+        for (unsigned m = 0; m < 3; m++)
+        {
+            glMatrixMode(matrices[m]);
+            glPushMatrix();
+            glLoadIdentity();
+        }
+        glColor4f(1.0, 1.0, 1.0, 1.0);
+        glBegin(GL_QUADS);
+        glTexCoord2f(0, 0); glVertex2f(-1, -1);
+        glTexCoord2f(1, 0); glVertex2f( 1, -1);
+        glTexCoord2f(1, 1); glVertex2f( 1,  1);
+        glTexCoord2f(0, 1); glVertex2f(-1,  1);
+        glEnd();
+        for (unsigned m = 0; m < 3; m++)
+        {
+            glMatrixMode(matrices[m]);
+            glPopMatrix();
+        }
+
+        if (image.mipmaps)
+        {
+            glBindTexture(GL_TEXTURE_2D, res->rgbTexture);
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+    }
+
+    glUseProgram(program);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glPopAttrib();
 
-    int dy = h-1;
-    for (int sy = 0; sy < h; sy++, dy--)
+    if (!ok)
     {
-        quint16* ssl = (quint16*)((quint8*)from + sy*w*2);
-        quint16* dsl = (quint16*)((quint8*)to + dy*w*2);
-        int dx = 0;
-        for (int sx = 0; sx < w; sx++, dx++)
-            dsl[dx] = ssl[sx];
+        // Planar pictures can't be shown: ask for RGB next time
+        std::cerr << "Video YUV conversion: incomplete framebuffer\n";
+        parent->planar = false;
     }
+    return ok;
 }
-#endif
 
 
-static void convertToGLFormat(QImage &dst, const QImage &src)
+void VideoTrack::projectSize()
 // ----------------------------------------------------------------------------
-//   Convert from QImage::Format_RGB32 to GL_RGBA
+//   Estimate the size in pixels of the video on screen
 // ----------------------------------------------------------------------------
+//   We don't know the shape that will use the texture. Assume it is the
+//   size of the video in the current coordinates, as with 'movie'.
+//   With a region, that is the size of the region, so scale the result.
 {
-    // Adapted from Qt source code: qglcpp
-    // (License: LGPL)
+    GLdouble mv[16], proj[16];
+    GLint viewport[4];
+    glGetDoublev(GL_MODELVIEW_MATRIX, mv);
+    glGetDoublev(GL_PROJECTION_MATRIX, proj);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    double xmin = DBL_MAX, xmax = -DBL_MAX, ymin = DBL_MAX, ymax = -DBL_MAX;
+    for (unsigned corner = 0; corner < 4; corner++)
+    {
+        double x = (corner & 1) ? width() / 2.0 : -(width() / 2.0);
+        double y = (corner & 2) ? height() / 2.0 : -(height() / 2.0);
+        double eye[4], clip[4];
+        for (unsigned i = 0; i < 4; i++)
+            eye[i] = mv[i] * x + mv[4+i] * y + mv[12+i];
+        for (unsigned i = 0; i < 4; i++)
+            clip[i] = (proj[i] * eye[0] + proj[4+i] * eye[1] +
+                       proj[8+i] * eye[2] + proj[12+i] * eye[3]);
+        if (clip[3] <= 0)
+            return;             // Behind the camera
+        double sx = (clip[0] / clip[3] + 1) * viewport[2] / 2;
+        double sy = (clip[1] / clip[3] + 1) * viewport[3] / 2;
+        xmin = qMin(xmin, sx);
+        xmax = qMax(xmax, sx);
+        ymin = qMin(ymin, sy);
+        ymax = qMax(ymax, sy);
+    }
 
-    XL_ASSERT(src.depth() == 32);
-    XL_ASSERT(dst.depth() == 32);
+    // The same track may be drawn several times: keep the largest
+    projectedW = qMax(projectedW, (xmax - xmin) * displayW / width());
+    projectedH = qMax(projectedH, (ymax - ymin) * displayH / height());
+}
 
-    const int width = src.width();
-    const int height = src.height();
-    const uint *p = (const uint*) src.scanLine(src.height() - 1);
-    uint *q = (uint*) dst.scanLine(0);
 
-    if (QSysInfo::ByteOrder == QSysInfo::BigEndian)
+int VideoTrack::adaptShift()
+// ----------------------------------------------------------------------------
+//   Return the decode size reduction (as a shift) to switch to, or -1
+// ----------------------------------------------------------------------------
+//   Enlarging happens when the video is bigger on screen than decoded.
+//   Reducing requires 25% margin, so that we don't toggle between sizes.
+//   Both need the size on screen to be stable for a number of frames.
+{
+    if (!projectedW || !projectedH)
+        return -1;
+
+    int fit = 0, reduced = 0;
+    while (fit < MAX_DECODE_SHIFT &&
+           (displayW >> (fit + 1)) >= projectedW &&
+           (displayH >> (fit + 1)) >= projectedH &&
+           (displayW >> (fit + 1)) >= MIN_DECODE_SIZE)
+        fit++;
+    while (reduced < fit &&
+           (displayW >> (reduced + 1)) >= projectedW * 1.25 &&
+           (displayH >> (reduced + 1)) >= projectedH * 1.25)
+        reduced++;
+    projectedW = projectedH = 0;
+
+    int shift = decodeShift;
+    unsigned frames = ADAPT_UP_FRAMES;
+    if (fit < decodeShift)
     {
-        for (int i=0; i < height; ++i)
-        {
-            const uint *end = p + width;
-            while (p < end)
-            {
-                *q = (*p << 8) | ((*p >> 24) & 0xff);
-                p++;
-                q++;
-            }
-            p -= 2 * width;
-        }
+        shift = fit;
     }
-    else
+    else if (reduced > decodeShift)
     {
-        for (int i=0; i < height; ++i)
-        {
-            const uint *end = p + width;
-            while (p < end)
-            {
-                *q = ((*p << 16) & 0xff0000) | ((*p >> 16) & 0xff)
-                                             | (*p & 0xff00ff00);
-                p++;
-                q++;
-            }
-            p -= 2 * width;
-        }
+        shift = reduced;
+        frames = ADAPT_DOWN_FRAMES;
     }
+    if (shift == decodeShift)
+    {
+        adaptFrames = 0;
+        return -1;
+    }
+    if (++adaptFrames < frames)
+        return -1;
+    adaptFrames = 0;
+    return shift;
 }
 
 
@@ -582,58 +1385,99 @@ void VideoTrack::transferPBO()
 // ----------------------------------------------------------------------------
 //   PBO update and GL texture transfer
 // ----------------------------------------------------------------------------
+//   The picture is copied into the next free PBO of the ring, and the texture
+//   is updated from that PBO right away, so that it shows in this frame.
+//   A fence tells when the GPU is done with the PBO, which is only reused
+//   after that. If all PBOs are still busy, the upload is retried later.
 {
     XL_ASSERT(image.ptr);
     XL_ASSERT(image.size);
 
     checkGLContext();
+    native = !convert;
+    if (res->pboSize != image.size)
+    {
+        // videoFormat() changed the size of pictures
+        deletePBO();
+        genPBO();
+    }
 
-    bool firstFrame = (curPBOPtr == (GLubyte *)1);
+    // Find a PBO the GPU is done with, starting with the oldest one
+    int count = res->pbos.size();
+    int slot = -1;
+    for (int i = 0; i < count && slot < 0; i++)
+    {
+        int k = (res->curPBO + i) % count;
+        if (res->pboFences[k])
+        {
+            GLenum status = glClientWaitSync(res->pboFences[k], 0, 0);
+            if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+                continue;
+            glDeleteSync(res->pboFences[k]);
+            res->pboFences[k] = 0;
+        }
+        slot = k;
+    }
+    if (slot < 0)
+    {
+        pboWaits++;
+        return;
+    }
 
     // Assure we save and restore settings to avoid
     // conflict with Tao GL states
     glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
 
-    // Copy and convert at the same time the latest picture into the current
-    // PBO
-    GL.BindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[curPBO]);
-    curPBOPtr = (GLubyte*) GL.MapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
-    if (!curPBOPtr)
+    // Copy and convert at the same time the latest picture into the PBO.
+    // The fence guarantees the GPU no longer reads it: don't synchronize
+    GLuint t = GL_PIXEL_UNPACK_BUFFER;
+    GL.BindBuffer(t, res->pbos[slot]);
+    GLubyte *ptr = NULL;
+    if (GLEW_ARB_map_buffer_range)
+        ptr = (GLubyte *) glMapBufferRange(t, 0, image.size,
+                                           GL_MAP_WRITE_BIT |
+                                           GL_MAP_INVALIDATE_BUFFER_BIT |
+                                           GL_MAP_UNSYNCHRONIZED_BIT);
+    else
+        ptr = (GLubyte *) GL.MapBuffer(t, GL_WRITE_ONLY);
+    if (!ptr)
     {
-        curPBOPtr = (GLubyte*)1;
         glPopClientAttrib();
         return;
     }
+    // Only the region uploaded by doGLTexImage2D() needs to be valid
+    Region &r = roi;
+    if (!convert || earlyConvert)
+    {
+        // Either GL swaps R and B and Draw() flips the texture coordinates,
+        // or convertFrame() already did the work in the libVLC thread
+        copyRegion(ptr, image.ptr, r);
+    }
 #if defined(Q_OS_MACX)
-    if (image.chroma == UYVY)
+    else if (image.chroma == UYVY)
     {
-        verticalFlip16(curPBOPtr, image.ptr, w, h);
+        verticalFlip16(ptr, image.ptr, image.plane[0].width,
+                       image.plane[0].height, r.x, r.y, r.width, r.height);
     }
-    else
 #endif
+    else
     {
-        QImage from((const uchar *)image.ptr, w, h, QImage::Format_RGB32);
-        QImage to((uchar *)curPBOPtr, w, h, QImage::Format_RGB32);
-        convertToGLFormat(to, from);
+        convertToGLFormat(ptr, image.ptr, image.plane[0].width,
+                          image.plane[0].height, r.x, r.y, r.width, r.height);
     }
-    GL.UnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    GL.UnmapBuffer(t);
 
-    // Copy from previous PBO to texture
-
-    if (!firstFrame)
-    {
-        GL.BindTexture(GL_TEXTURE_2D, textureId);
-        GL.BindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[1-curPBO]);
-        doGLTexImage2D();
-    }
+    // Copy from PBO to texture, and know when the GPU is done with the PBO
+    doGLTexImage2D(NULL);
+    res->pboFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 
     // Restore saved settings
     glPopClientAttrib();
 
-    curPBO = 1 - curPBO;
+    res->curPBO = (slot + 1) % count;
 
     if (parent)
-        frameTime = parent->updateTime(frameTime);
+        frameTime = parent->updateTime(frameTime, fps());
 }
 
 
@@ -643,244 +1487,1552 @@ void VideoTrack::transferNoPBO()
 // ----------------------------------------------------------------------------
 {
     checkGLContext();
+    native = !convert;
 
-    GL.BindTexture(GL_TEXTURE_2D, textureId);
-    doGLTexImage2D();
+    doGLTexImage2D(image.ptr);
 
     if (parent)
-        frameTime = parent->updateTime(frameTime);
+        frameTime = parent->updateTime(frameTime, fps());
 }
 
 
-void VideoTrack::doGLTexImage2D()
+void VideoTrack::transferMapped()
 // ----------------------------------------------------------------------------
-//   GL texture transfer
+//   Zero-copy: libVLC decoded into GL memory, only upload the texture
 // ----------------------------------------------------------------------------
 {
-    GLenum format = GL_RGBA, type = GL_UNSIGNED_BYTE;
-#ifdef Q_OS_MACX
-    if (image.chroma == UYVY /* mirrored */)
+    XL_ASSERT(image.ptr);
+
+    checkGLContext();
+    native = true;
+
+    // videoFormat() retired the mapped buffer if frames don't fit anymore
+    if (!mappedBuffer ||
+        (mappedStride < FramePool::stride(image.size) &&
+         QGLContext::currentContext() == mappedContext))
     {
-        format = GL_YCBCR_422_APPLE;
-        type = GL_UNSIGNED_SHORT_8_8_APPLE; // 2 bytes per pixel
-        if (w % 2)
+        genMappedBuffer();
+        if (!zeroCopy)
         {
-            // Row size in bytes is w * 2, which is not a multiple of 4
-            // (the default value for GL_UNPACK_ALIGNEMENT) when w is odd.
-            GL.PixelStorei(GL_UNPACK_ALIGNMENT, 2);
+            transferPBO();
+            return;
         }
     }
-#endif
-    GL.TexImage2D(GL_TEXTURE_2D, 0, 3, w, h, 0, format, type,
-                 usePBO ? NULL : image.ptr);
-    videoAvailableInTexture = true;
+
+    // Frames outside of the mapped buffer (pool misses, or frames drawn
+    // in another GL context) are uploaded from client memory
+    int slot = -1;
+    if (mappedBuffer && QGLContext::currentContext() == mappedContext)
+        slot = pool.index(image.ptr);
+
+    glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+    if (slot >= 0)
+    {
+        GL.BindBuffer(GL_PIXEL_UNPACK_BUFFER, mappedBuffer);
+        doGLTexImage2D((const void *) ((char *) image.ptr - mappedBase));
+
+        // The slot can't be given back to libVLC before the GPU is done
+        if (fences[slot])
+            glDeleteSync(fences[slot]);
+        fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    else
+    {
+        GL.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        doGLTexImage2D(image.ptr);
+    }
+    glPopClientAttrib();
+
+    if (parent)
+        frameTime = parent->updateTime(frameTime, fps());
 }
 
 
-void VideoTrack::updateTexture()
+void VideoTrack::releaseRetired()
 // ----------------------------------------------------------------------------
-//   Update the texture in a thread-safe way
+//   Zero-copy: give back to the pool the frames the GPU is done reading
 // ----------------------------------------------------------------------------
 {
-    if (videoAvailable)
+    int kept = 0;
+    for (int i = 0; i < retired.size(); i++)
     {
-        mutex.lock();
-        if (updated)
+        void *frame = retired[i];
+        int slot = pool.index(frame);
+        if (slot >= 0 && slot < fences.size() && fences[slot])
         {
-            if (usePBO)
-                transferPBO();
-            else
-                transferNoPBO();
-            updated = false;
+            GLenum status = glClientWaitSync(fences[slot], 0, 0);
+            if (status == GL_TIMEOUT_EXPIRED)
+            {
+                retired[kept++] = frame;
+                continue;
+            }
+            glDeleteSync(fences[slot]);
+            fences[slot] = 0;
         }
-        mutex.unlock();
+        freeFrame(frame);
     }
+    retired.resize(kept);
 }
 
 
-GLuint VideoTrack::texture()
+void VideoTrack::uploadFrame()
 // ----------------------------------------------------------------------------
-//   Update texture with current frame and return texture ID
+//   Upload the pending frame into a texture of the ring, in VideoUploader
 // ----------------------------------------------------------------------------
+//   The GL state cache of Tao belongs to the render thread, so only plain
+//   OpenGL calls are made here. The ring is in 'upload', and its textures
+//   are made by this thread, see genUploadStorage(). The frame, its format
+//   and the texture are taken with 'mutex' locked, then uploaded without
+//   it: the upload is dropped if the format changed meanwhile.
 {
-    return videoAvailableInTexture ? textureId : 0;
+    mutex.lock();
+    void *frame = image.size ? takeFrame(-1) : NULL;
+    if (!frame)
+    {
+        mutex.unlock();
+        return;
+    }
+    if (!upload.storageValid)
+        genUploadStorage();
+
+    // A texture not taken by the render thread yet is superseded
+    int k = ready >= 0 ? ready : freeTexture();
+    ready = -1;
+    Texture t = upload.textures[k];
+    ImageBuf format = image;
+    Region region = roi;
+    unsigned storage = uploadStorage;
+    native = !convert;
+    mutex.unlock();
+
+    QElapsedTimer timer;
+    timer.start();
+    for (unsigned p = 0; p < format.planes; p++)
+    {
+        PlaneFormat f = planeFormat(format, p, region);
+        const char *pixels = (const char *) frame + format.plane[p].offset;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, f.alignment);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, f.width);
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, f.skipPixels);
+        glPixelStorei(GL_UNPACK_SKIP_ROWS, f.skipRows);
+        glBindTexture(GL_TEXTURE_2D, t.planes[p]);
+        if (!t.allocated)
+        {
+            if (f.internal == GL_RGBA8 && hasSwizzle())
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_A, GL_ONE);
+            GLsizei levels = format.mipmaps ? mipmapLevels(f.width, f.height)
+                                            : 1;
+            if (GLEW_ARB_texture_storage)
+                glTexStorage2D(GL_TEXTURE_2D, levels,
+                               f.internal, f.width, f.height);
+            else
+                glTexImage2D(GL_TEXTURE_2D, 0, f.internal, f.width, f.height,
+                             0, f.format, f.type, NULL);
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, f.subWidth, f.subHeight,
+                        f.format, f.type, pixels);
+        if (format.mipmaps)
+            glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    qint64 elapsed = timer.nsecsElapsed();
+
+    // GL has a copy of the pixels, the frame can go back to libVLC
+    dropFrame(frame);
+
+    QMutexLocker locker(&mutex);
+    if (format.seq != image.seq || storage != uploadStorage ||
+        !upload.storageValid)
+    {
+        glDeleteSync(fence);
+        return;
+    }
+    Texture &done = upload.textures[k];
+    done.allocated = true;
+    done.region = region;
+    if (readyFence)
+        glDeleteSync(readyFence);
+    readyFence = fence;
+    ready = k;
+    uploadTiming.add(elapsed);
+    VlcVideoBase::wakeUp();
 }
 
 
-void VideoTrack::checkGLContext()
+void VideoTrack::takeUpload()
 // ----------------------------------------------------------------------------
-//   Detect change in current GL context.
+//   Render thread: make the texture uploaded by VideoUploader the front one
 // ----------------------------------------------------------------------------
+//   Never waits for an upload in progress: the current front texture is
+//   drawn once more instead.
 {
-    const QGLContext * current = QGLContext::currentContext();
-    if (current != GLcontext)
+    if (!mutex.tryLock())
+        return;
+
+    // The uploader thread only shares objects with the first context
+    if (!res)
+        checkGLContext();
+    int seq = image.seq;
+    applyLayout();
+    if (image.seq != seq && hasQueuedFrames())
+        VideoUploader::post(this);
+    if (isPlanar() && !res->yuvShaderReady && image.size)
+        setYuvUniforms();
+    roi = textureRegion();         // Takes effect with the next frame
+
+    if (ready >= 0)
     {
-        IFTRACE(video)
-            if (GLcontext)
-                debug() << "GL context changed\n";
-        genTexture();
-        if (usePBO && image.size)
-            genPBO();
-        GLcontext = current;
+        // The GPU waits for the upload, the render thread does not
+        fenceFront();
+        glWaitSync(readyFence, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(readyFence);
+        readyFence = 0;
+        upload.front = ready;
+        ready = -1;
+        videoAvailableInTexture = true;
+        if (parent)
+            frameTime = parent->updateTime(frameTime, fps());
     }
+
+    mutex.unlock();
 }
 
 
-void VideoTrack::genTexture()
+void VideoTrack::genUploadStorage()
 // ----------------------------------------------------------------------------
-//   Create GL texture to render to
+//   VideoUploader: make the textures of its ring for the current format
 // ----------------------------------------------------------------------------
+//   Called with 'mutex' locked. The render thread stopped drawing the
+//   previous ones in applyLayout(), and the names are shared with it.
 {
-    GL.GenTextures(1, &textureId);
-    IFTRACE(video)
-        debug() << "Texture allocated: #" << textureId << "\n";
+    deleteUploadStorage();
+    GLsizei planes = isPlanar() ? image.planes : 1;
+    for (int k = 0; k < TEXTURE_COUNT; k++)
+        glGenTextures(planes, upload.textures[k].planes);
+    upload.storageValid = true;
+    uploadStorage++;
 }
 
 
-void VideoTrack::genPBO()
+void VideoTrack::deleteUploadStorage()
 // ----------------------------------------------------------------------------
-//   Create two GL Pixel Buffer Objects for asynchronous transfer to texture
+//   Delete the ring of VideoUploader, called with 'mutex' locked
 // ----------------------------------------------------------------------------
+//   Any context sharing objects with the uploader thread can do it.
 {
-    XL_ASSERT(image.size);
-    GLuint t = GL_PIXEL_UNPACK_BUFFER;
+    for (int k = 0; k < TEXTURE_COUNT; k++)
+    {
+        Texture &t = upload.textures[k];
+        for (unsigned p = 0; p < 3; p++)
+            if (t.planes[p])
+                glDeleteTextures(1, &t.planes[p]);
+        if (t.used)
+            glDeleteSync(t.used);
+    }
+    memset(upload.textures, 0, sizeof(upload.textures));
+    upload.front = -1;
+    upload.storageValid = false;
+    if (readyFence)
+        glDeleteSync(readyFence);
+    readyFence = 0;
+    ready = -1;
+}
 
-    // Assure we save and restore settings to avoid
-    // conflict with Tao GL states
-    glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
-    GL.GenBuffers(2, pbo);
-    GL.BindBuffer(t, pbo[0]);
-    GL.BufferData(t, image.size, NULL, GL_STREAM_DRAW);
-    GL.BindBuffer(t, pbo[1]);
-    GL.BufferData(t, image.size, NULL, GL_STREAM_DRAW);
-    curPBOPtr = (GLubyte *)1; // REVISIT?
-    curPBO = 1;
 
-    // Restore saved settings
+void VideoTrack::doGLTexImage2D(const void *pixels)
+// ----------------------------------------------------------------------------
+//   GL texture transfer into the back texture, which then becomes the front
+// ----------------------------------------------------------------------------
+{
+    if (!res->storageValid)
+        genStorage();
+    if (isPlanar() && !res->yuvShaderReady)
+        setYuvUniforms();
+    Texture &t = res->textures[back];
+
+    // One texture per plane, NV12 has U and V interleaved
+    glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+    for (unsigned p = 0; p < image.planes; p++)
+    {
+        PlaneFormat f = planeFormat(p, roi);
+        GL.PixelStorei(GL_UNPACK_ALIGNMENT, f.alignment);
+        texSubImage(t, p, f, (const char *) pixels + image.plane[p].offset);
+    }
     glPopClientAttrib();
 
-    IFTRACE(video)
-        debug() << "PBOs and buffers allocated: #"
-                << pbo[0] << ", #" << pbo[1] << "\n";
+    t.allocated = true;
+    t.region = roi;
+    res->front = back;
+    res->uploaded = frameSeq;
+    videoAvailableInTexture = true;
 }
 
 
-void VideoTrack::stop()
+VideoTrack::PlaneFormat VideoTrack::planeFormat(const ImageBuf &format,
+                                                unsigned plane,
+                                                const Region &r)
+// ----------------------------------------------------------------------------
+//   How to store a plane of an image in the given format, and region r of it
+// ----------------------------------------------------------------------------
+//   Chroma planes of planar formats are subsampled by 2. Pictures converted
+//   on the CPU are flipped, so the region is counted from the bottom.
 {
-    videoAvailable = false;
-    videoAvailableInTexture = false;
+    const Plane &p = format.plane[plane];
+    bool planar = format.planes > 1;
+    unsigned shift = planar && plane > 0;
+    unsigned x0 = r.x >> shift, y0 = r.y >> shift;
+    unsigned x1 = qMin((r.x + r.width + shift) >> shift, p.width);
+    unsigned y1 = qMin((r.y + r.height + shift) >> shift, p.height);
+    PlaneFormat f = { GL_LUMINANCE8, GL_LUMINANCE, GL_UNSIGNED_BYTE,
+                      GLsizei(p.width), GLsizei(p.height), 1,
+                      GLint(x0), GLint(native ? y0 : p.height - y1),
+                      GLsizei(x1 - x0), GLsizei(y1 - y0) };
+
+    if (planar)
+    {
+        if (format.chroma == NV12 && plane == 1)
+        {
+            f.internal = GL_LUMINANCE8_ALPHA8;
+            f.format = GL_LUMINANCE_ALPHA;
+        }
+        return f;
+    }
+
+    // RV32 has an unused 4th byte: store it, but always read alpha as 1
+    f.internal = hasSwizzle() ? GL_RGBA8 : GL_RGB8;
+    f.format = GL_RGBA;
+    f.alignment = 4;
+    if (native && format.chroma == RV32)
+    {
+        // Let GL swap R and B, whatever the byte order
+        f.format = GL_BGRA;
+        f.type = GL_UNSIGNED_INT_8_8_8_8_REV;
+    }
+#ifdef Q_OS_MACX
+    if (format.chroma == UYVY /* mirrored */)
+    {
+        f.internal = GL_RGB8;
+        f.format = GL_YCBCR_422_APPLE;
+        f.type = GL_UNSIGNED_SHORT_8_8_APPLE; // 2 bytes per pixel
+
+        // Row size in bytes is w * 2, which is not a multiple of 4
+        // (the default value for GL_UNPACK_ALIGNEMENT) when w is odd.
+        if (format.plane[0].width % 2)
+            f.alignment = 2;
+    }
+#endif
+    return f;
 }
 
 
+void VideoTrack::texSubImage(Texture &t, unsigned plane,
+                             const PlaneFormat &f, const void *pixels)
+// ----------------------------------------------------------------------------
+//   Upload pixels into a texture, allocating its storage on first use
+// ----------------------------------------------------------------------------
+{
+    GL.BindTexture(GL_TEXTURE_2D, t.planes[plane]);
+    if (!t.allocated)
+    {
+        if (f.internal == GL_RGBA8 && hasSwizzle())
+            GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_A, GL_ONE);
+        if (GLEW_ARB_texture_storage)
+        {
+            GLsizei levels = image.mipmaps ? mipmapLevels(f.width, f.height)
+                                           : 1;
+            glTexStorage2D(GL_TEXTURE_2D, levels,
+                           f.internal, f.width, f.height);
+        }
+        else
+        {
+            // Mutable storage, but allocated only once for this size.
+            // If a PBO is bound, this reads the start of it: stay inside
+            GL.PixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            GL.PixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+            GL.PixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+            GL.TexImage2D(GL_TEXTURE_2D, 0, f.internal, f.width, f.height, 0,
+                          f.format, f.type, NULL);
+        }
+    }
+
+    // Only the region is uploaded, to the bottom left of the texture
+    GL.PixelStorei(GL_UNPACK_ROW_LENGTH, f.width);
+    GL.PixelStorei(GL_UNPACK_SKIP_PIXELS, f.skipPixels);
+    GL.PixelStorei(GL_UNPACK_SKIP_ROWS, f.skipRows);
+    GL.TexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, f.subWidth, f.subHeight,
+                     f.format, f.type, pixels);
+
+    // Shrinking on the GPU: smaller levels avoid aliasing
+    if (image.mipmaps)
+        glGenerateMipmap(GL_TEXTURE_2D);
+}
+
 
-void * VideoTrack::lockFrame(void *obj, void **plane)
+GLsizei VideoTrack::mipmapLevels(GLsizei w, GLsizei h)
 // ----------------------------------------------------------------------------
-//   Allocate video memory
+//   Number of levels of a complete mipmap chain for a w x h texture
 // ----------------------------------------------------------------------------
 {
-    VideoTrack *v = (VideoTrack *)obj;
-    XL_ASSERT(v->image.size);
+    GLsizei levels = 1;
+    for (GLsizei s = qMax(w, h); s > 1; s >>= 1)
+        levels++;
+    return levels;
+}
 
-#ifdef Q_OS_WIN32
-    *plane = __mingw_aligned_malloc(v->image.size, 32);
-    if (!*plane)
-        throw std::bad_alloc();
-#else
-    if (posix_memalign(plane, 32, v->image.size))
-        throw std::bad_alloc();
-#endif
 
-    v->allocatedFrames.insert(*plane);
-    return *plane;
+VideoTrack::Region VideoTrack::textureRegion()
+// ----------------------------------------------------------------------------
+//   The part of frames to upload, in texels of the first plane
+// ----------------------------------------------------------------------------
+//   cropX, cropY, cropW, cropH are in pixels of the reported size, which
+//   is not the decoded size with adaptive decoding. All formats but RV32
+//   have pairs of pixels sharing chroma, so the region starts on even ones.
+//   The size is that of image, the one of w and h may be for next frames.
+{
+    unsigned fw = image.plane[0].width, fh = image.plane[0].height;
+    Region r = { 0, 0, fw, fh };
+    if (cropW <= 0 || cropH <= 0 || !displayW || !displayH || !fw || !fh)
+        return r;
+
+    double sx = double(fw) / displayW, sy = double(fh) / displayH;
+    unsigned x0 = qBound(0.0, floor(cropX * sx), double(fw - 1));
+    unsigned y0 = qBound(0.0, floor(cropY * sy), double(fh - 1));
+    unsigned x1 = qBound(double(x0 + 1), ceil((cropX + cropW) * sx),
+                         double(fw));
+    unsigned y1 = qBound(double(y0 + 1), ceil((cropY + cropH) * sy),
+                         double(fh));
+    if (image.chroma != RV32)
+    {
+        x0 &= ~1U;
+        y0 &= ~1U;
+    }
+    r.x = x0;
+    r.y = y0;
+    r.width = x1 - x0;
+    r.height = y1 - y0;
+    return r;
 }
 
 
-void VideoTrack::displayFrame(void *obj, void *picture)
+void VideoTrack::copyRegion(void *to, const void *from, const Region &r)
 // ----------------------------------------------------------------------------
-//   Copy frame to texture
+//   Copy the rows of region r of each plane, leaving the rest of 'to' as is
 // ----------------------------------------------------------------------------
 {
-    VideoTrack *v = (VideoTrack *)obj;
-    XL_ASSERT(v->w && v->h && "Invalid video size");
+    if (r.width == image.plane[0].width && r.height == image.plane[0].height)
+    {
+        memcpy(to, from, image.size);
+        return;
+    }
 
-    if (v->dropFrames())
+    for (unsigned p = 0; p < image.planes; p++)
     {
-        v->freeFrame(picture);
+        Plane &plane = image.plane[p];
+        PlaneFormat f = planeFormat(p, r);
+        unsigned bpp = plane.pitch / plane.width;
+        size_t offset = (plane.offset + size_t(f.skipRows) * plane.pitch +
+                         f.skipPixels * bpp);
+        size_t bytes = size_t(f.subWidth) * bpp;
+        for (GLsizei i = 0; i < f.subHeight; i++, offset += plane.pitch)
+            memcpy((char *) to + offset, (const char *) from + offset, bytes);
+    }
+}
+
+
+void VideoTrack::setRegion(float x, float y, float w, float h)
+// ----------------------------------------------------------------------------
+//   Show only a rectangle of the video, see VlcVideoSurface::setRegion()
+// ----------------------------------------------------------------------------
+//   The texture is updated from the current frame, even if paused.
+{
+    cropX = x;
+    cropY = y;
+    cropW = w;
+    cropH = h;
+}
+
+
+// Vertex shader for YUV textures: only pass the texture coordinates along
+static const char *yuvVertexShader =
+    "void main()\n"
+    "{\n"
+    "    gl_TexCoord[0] = gl_TextureMatrix[0] * gl_MultiTexCoord0;\n"
+    "    gl_FrontColor = gl_Color;\n"
+    "    gl_Position = ftransform();\n"
+    "}\n";
+
+
+// Fragment shader for YUV textures: sample Y, U and V, convert to RGB
+static const char *yuvFragmentShader =
+    "uniform sampler2D yPlane, uPlane, vPlane;\n"
+    "uniform bool      interleaved;\n"
+    "uniform vec3      offset, rCoeffs, gCoeffs, bCoeffs;\n"
+    "\n"
+    "void main()\n"
+    "{\n"
+    "    vec2 t = gl_TexCoord[0].st;\n"
+    "    vec3 yuv;\n"
+    "    yuv.x = texture2D(yPlane, t).r;\n"
+    "    if (interleaved)\n"
+    "        yuv.yz = texture2D(uPlane, t).ra;\n"
+    "    else\n"
+    "        yuv.yz = vec2(texture2D(uPlane, t).r, texture2D(vPlane, t).r);\n"
+    "    yuv -= offset;\n"
+    "    gl_FragColor = gl_Color * vec4(dot(rCoeffs, yuv),\n"
+    "                                   dot(gCoeffs, yuv),\n"
+    "                                   dot(bCoeffs, yuv), 1.0);\n"
+    "}\n";
+
+
+void VideoTrack::genYuvShader()
+// ----------------------------------------------------------------------------
+//   Build the shader converting YUV planes to RGB
+// ----------------------------------------------------------------------------
+{
+    res->yuvShader = new QGLShaderProgram(QGLContext::currentContext());
+    if (!res->yuvShader->addShaderFromSourceCode(QGLShader::Vertex,
+                                            yuvVertexShader) ||
+        !res->yuvShader->addShaderFromSourceCode(QGLShader::Fragment,
+                                            yuvFragmentShader) ||
+        !res->yuvShader->link())
+    {
+        // Planar pictures would be drawn as gray: ask for RGB next time
+        std::cerr << "Video YUV shader error: "
+                  << res->yuvShader->log().toUtf8().constData() << "\n";
+        delete res->yuvShader;
+        res->yuvShader = NULL;
+        parent->planar = false;
         return;
     }
+    IFTRACE(video)
+        debug() << "YUV shader built: #" << res->yuvShader->programId() << "\n";
+}
 
-    if (v->state() != VlcVideoBase::VS_PLAYING &&
-        v->state() != VlcVideoBase::VS_PAUSED &&
-        v->state() != VlcVideoBase::VS_STOPPED)
-        v->setState(VlcVideoBase::VS_PLAYING);
 
-    if (v->usePBO)
-        v->displayFramePBO(picture);
-    else
-        v->displayFrameNoPBO(picture);
+void VideoTrack::setYuvUniforms()
+// ----------------------------------------------------------------------------
+//   Set the YUV to RGB matrix in the shader, for the current colorimetry
+// ----------------------------------------------------------------------------
+{
+    if (!res->yuvShader)
+        genYuvShader();
+    if (!res->yuvShader)
+        return;
 
+    // Luma weights of red and blue, and scaling of the limited range
+    double kr = image.bt709 ? 0.2126 : 0.299;
+    double kb = image.bt709 ? 0.0722 : 0.114;
+    double kg = 1.0 - kr - kb;
+    double ys = image.fullRange ? 1.0 : 255.0 / 219.0;
+    double cs = image.fullRange ? 1.0 : 255.0 / 224.0;
+
+    // The program is not bound through Tao here: restore the current one
+    GLint current = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+    res->yuvShader->bind();
+    res->yuvShader->setUniformValue("yPlane", 0);
+    res->yuvShader->setUniformValue("uPlane", 1);
+    res->yuvShader->setUniformValue("vPlane", 2);
+    res->yuvShader->setUniformValue("interleaved", GLint(image.chroma == NV12));
+    res->yuvShader->setUniformValue("offset",
+                               GLfloat(image.fullRange ? 0 : 16.0 / 255.0),
+                               GLfloat(128.0 / 255.0),
+                               GLfloat(128.0 / 255.0));
+    res->yuvShader->setUniformValue("rCoeffs",
+                               GLfloat(ys),
+                               GLfloat(0.0),
+                               GLfloat(2 * (1 - kr) * cs));
+    res->yuvShader->setUniformValue("gCoeffs",
+                               GLfloat(ys),
+                               GLfloat(-2 * kb * (1 - kb) / kg * cs),
+                               GLfloat(-2 * kr * (1 - kr) / kg * cs));
+    res->yuvShader->setUniformValue("bCoeffs",
+                               GLfloat(ys),
+                               GLfloat(2 * (1 - kb) * cs),
+                               GLfloat(0.0));
+    glUseProgram(current);
+    res->yuvShaderReady = true;
 }
 
 
-void VideoTrack::freeFrame(void *picture)
+void VideoTrack::setFormat(Chroma chroma, bool bt709, bool fullRange,
+                           bool mipmaps)
 // ----------------------------------------------------------------------------
-//   Release video memory
+//   libVLC thread: compute the layout of the planes of the next frames
 // ----------------------------------------------------------------------------
+//   The consumers take the new layout with applyLayout(). Frames queued in
+//   the previous format are dropped, and the one being shown is kept until
+//   then, so that the libVLC thread never touches what they upload.
 {
-#ifdef Q_OS_WIN32
-    __mingw_aligned_free(picture);
-#else
-    free(picture);
-#endif
+    unsigned cw = (w + 1) / 2, ch = (h + 1) / 2; // Chroma plane size in 4:2:0
+    Plane *p = layout.plane;
+
+    QMutexLocker locker(&mutex);
+    dropQueuedFrames();
+    layout.chroma = chroma;
+    switch (chroma)
+    {
+    case I420:
+        layout.planes = 3;
+        p[0].set(0, w, w, h);
+        p[1].set(w * h, cw, cw, ch);
+        p[2].set(w * h + cw * ch, cw, cw, ch);
+        break;
+    case NV12:
+        layout.planes = 2;
+        p[0].set(0, w, w, h);
+        p[1].set(w * h, cw * 2, cw, ch);
+        break;
+    case UYVY:
+        layout.planes = 1;
+        p[0].set(0, w * 2, w, h);
+        break;
+    default:
+        layout.planes = 1;
+        p[0].set(0, w * 4, w, h);
+        break;
+    }
+    Plane &last = p[layout.planes - 1];
+    layout.size = last.offset + last.pitch * last.height;
+    layout.bt709 = bt709;
+    layout.fullRange = fullRange;
+    layout.mipmaps = mipmaps;
+    layout.seq++;
+}
+
+
+void VideoTrack::applyLayout()
+// ----------------------------------------------------------------------------
+//   Consumer: take the format set by setFormat(), called with 'mutex' locked
+// ----------------------------------------------------------------------------
+//   The frame in image.ptr has the previous format: it is not uploaded
+//   anymore. Changing 'mipmaps' also requires new textures, see genStorage()
+//   and genUploadStorage().
+{
+    if (image.seq == layout.seq)
+        return;
+    retireFrame(image.ptr);
+    image = layout;
+    image.ptr = NULL;
+    foreach (GLResources *r, contexts)
+    {
+        r->yuvShaderReady = false;
+        r->storageValid = false;
+        r->rgbValid = false;
+    }
 
-    allocatedFrames.remove(picture);
+    // VideoUploader makes new textures, stop drawing the previous ones
+    upload.storageValid = false;
+    upload.front = -1;
+    ready = -1;
 }
 
 
-void VideoTrack::displayFrameNoPBO(void *picture)
+void VideoTrack::updateTexture()
 // ----------------------------------------------------------------------------
-//   Prepare image pointer when Pixel Buffer Objects are NOT enabled
+//   Update the texture with the latest frame posted by libVLC, if any
 // ----------------------------------------------------------------------------
+//   The mutex only protects the format against videoFormat(): frames are
+//   taken, converted and uploaded without it, see queueFrame(). Each GL
+//   context uploads a given frame once, when its 'uploaded' sequence
+//   number is behind.
+//   Tao does not tell modules when the next buffer swap is, so it is
+//   estimated from the time between calls.
 {
-#if defined(Q_OS_MACX)
-    if (image.chroma == UYVY)
+    if (threadedUpload)
     {
-        // Hack: here, image is upside-down. To flip it use a QImage with a
-        // 16bpp format.
-        QImage image((const uchar *)picture, w, h, QImage::Format_RGB16);
-        QImage converted = image.mirrored();
-        freeFrame(picture);
-        mutex.lock();
-        this->image.converted = converted;
-        this->image.ptr = this->image.converted.bits();
+        takeUpload();
+        return;
     }
-    else
-#endif
+    qint64 now = monotonicTime();
+    renderPeriod = averagePeriod(renderPeriod, lastRender, now);
+    if (!hasQueuedFrames() && !needsUpload() && retired.isEmpty() &&
+        QGLContext::currentContext() == GLcontext && textureRegion() == roi)
+        return;
+
     {
-        QImage image((const uchar *)picture, w, h, QImage::Format_RGB32);
-        QImage converted = QGLWidget::convertToGLFormat(image);
-        freeFrame(picture);
-        mutex.lock();
-        this->image.converted = converted;
-        this->image.ptr = this->image.converted.bits();
+        // The format is the only state shared with libVLC, see setFormat()
+        QMutexLocker locker(&mutex);
+        checkGLContext();
+        applyLayout();
     }
-    updated = true;
-    mutex.unlock();
-    videoAvailable = true;
+    Region r = textureRegion();
+    if (r != roi)
+    {
+        // Upload the current frame again in all contexts
+        roi = r;
+        foreach (GLResources *c, contexts)
+            c->uploaded = 0;
+    }
+    qint64 due = parent->stepping.load() ? qint64(parent->stepTarget * 1e9)
+                                  : now + renderPeriod;
+    void *frame = takeFrame(due);
+    if (frame)
+    {
+        retireFrame(image.ptr);
+        image.ptr = frame;
+        frameSeq++;
+    }
+    else if (image.ptr && state() == VlcVideoBase::VS_PLAYING)
+    {
+        repeated++;
+    }
+    if (needsUpload())
+    {
+        QElapsedTimer timer;
+        timer.start();
+        back = nextTexture();
+        if (zeroCopy)
+            transferMapped();
+        else if (usePBO)
+            transferPBO();
+        else
+            transferNoPBO();
+        uploadTiming.add(timer.nsecsElapsed());
+    }
+    if (!retired.isEmpty())
+        releaseRetired();
 }
 
 
-void VideoTrack::displayFramePBO(void *picture)
+double VideoTrack::frameCost()
 // ----------------------------------------------------------------------------
-//   Prepare image pointer when Pixel Buffer Objects are enabled
+//   Average time spent converting and uploading a frame, in us
 // ----------------------------------------------------------------------------
+//   Conversion is only counted when done on the CPU, see convertFrame().
 {
-    mutex.lock();
-    void * prev = image.ptr;
-    image.ptr = picture;
-    updated = true;
-    videoAvailable = true;
-    mutex.unlock();
+    return convertTiming.average() + uploadTiming.average();
+}
 
-    freeFrame(prev);
+
+GLuint VideoTrack::texture()
+// ----------------------------------------------------------------------------
+//   Update texture with current frame and return texture ID
+// ----------------------------------------------------------------------------
+//   Planar pictures are shown through rgbTexture, filled by convertYuv().
+{
+    GLResources *g = ring();
+    if (!videoAvailableInTexture || !res || !g || g->front < 0)
+        return 0;
+    if (!isPlanar())
+        return g->textures[g->front].planes[0];
+    if (!res->rgbTexture)
+        GL.GenTextures(1, &res->rgbTexture);
+    return res->rgbTexture;
+}
+
+
+void VideoTrack::checkGLContext()
+// ----------------------------------------------------------------------------
+//   Select the GL objects of the current context, creating them if needed
+// ----------------------------------------------------------------------------
+//   A track drawn in several contexts (stereo, a preview window) keeps
+//   objects for each of them, until the context is destroyed.
+{
+    const QGLContext * current = QGLContext::currentContext();
+    if (current == GLcontext && res)
+        return;
+
+    IFTRACE(video)
+        if (GLcontext)
+            debug() << "GL context changed\n";
+    GLcontext = current;
+    res = contexts.value(current);
+    if (res)
+        return;
+
+    res = new GLResources;
+    contexts[current] = res;
+    if (current)
+        res->watcher = new VideoContextWatcher(this, current);
+    // With zero-copy, the mapped buffer is created by transferMapped(),
+    // and is kept when the context changes
+    if (usePBO && !zeroCopy && image.size)
+        genPBO();
+}
+
+
+void VideoTrack::releaseContext(const QGLContext *context, bool destroyed)
+// ----------------------------------------------------------------------------
+//   Delete the GL objects of this track in the given context
+// ----------------------------------------------------------------------------
+//   The context is made current for that, then the previous one is restored.
+{
+    QMutexLocker locker(&mutex);
+    GLResources *r = contexts.take(context);
+    if (!r)
+        return;
+
+    const QGLContext *current = QGLContext::currentContext();
+    if (context && current != context)
+        const_cast<QGLContext *>(context)->makeCurrent();
+    GLResources *saved = res;
+    res = r;
+    deleteResources();
+    res = saved == r ? NULL : saved;
+    if (threadedUpload && contexts.isEmpty())
+        deleteUploadStorage();
+    if (current && current != context)
+        const_cast<QGLContext *>(current)->makeCurrent();
+    if (GLcontext == context)
+        GLcontext = NULL;
+
+    // When called from the watcher, it can't be deleted right away
+    if (destroyed)
+        r->watcher->deleteLater();
+    else
+        delete r->watcher;
+    delete r;
+}
+
+
+void VideoTrack::deleteResources()
+// ----------------------------------------------------------------------------
+//   Delete the textures, shader and PBOs of the current context
+// ----------------------------------------------------------------------------
+{
+    deleteTextures();
+    delete res->yuvShader;
+    res->yuvShader = NULL;
+    if (res->rgbTexture)
+        GL.DeleteTextures(1, &res->rgbTexture);
+    if (res->rgbFramebuffer)
+        glDeleteFramebuffers(1, &res->rgbFramebuffer);
+    res->rgbTexture = 0;
+    res->rgbFramebuffer = 0;
+    res->rgbValid = false;
+    if (!res->pbos.isEmpty())
+        deletePBO();
+}
+
+
+int VideoTrack::nextTexture()
+// ----------------------------------------------------------------------------
+//   Return a texture of the ring the GPU is not drawing with
+// ----------------------------------------------------------------------------
+{
+    fenceFront();
+    return freeTexture();
+}
+
+
+void VideoTrack::fenceFront()
+// ----------------------------------------------------------------------------
+//   Fence the drawing of the front texture in the frames rendered so far
+// ----------------------------------------------------------------------------
+//   Called by the render thread when front is about to change, since by now
+//   these frames have been submitted.
+{
+    GLResources *g = ring();
+    if (g->front >= 0 && g->textures[g->front].drawn)
+    {
+        Texture &t = g->textures[g->front];
+        if (t.used)
+            glDeleteSync(t.used);
+        t.used = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        t.drawn = false;
+    }
+}
+
+
+int VideoTrack::freeTexture()
+// ----------------------------------------------------------------------------
+//   Return the first texture after front that the GPU is done drawing
+// ----------------------------------------------------------------------------
+//   The front texture is never written. With VideoUploader, called by its
+//   thread with 'mutex' locked.
+{
+    GLResources *g = ring();
+    for (int i = 1; i <= TEXTURE_COUNT; i++)
+    {
+        int k = (g->front + i + TEXTURE_COUNT) % TEXTURE_COUNT;
+        Texture &t = g->textures[k];
+        if (k == g->front)
+            continue;
+        if (t.used)
+        {
+            GLenum status = glClientWaitSync(t.used, 0, 0);
+            if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+                continue;
+            glDeleteSync(t.used);
+            t.used = 0;
+        }
+        return k;
+    }
+
+    // All textures are in flight: take the oldest, the driver will wait
+    ringExhausted++;
+    return (g->front + 1) % TEXTURE_COUNT;
+}
+
+
+void VideoTrack::genStorage()
+// ----------------------------------------------------------------------------
+//   Replace textures so that storage can be allocated for the current format
+// ----------------------------------------------------------------------------
+//   Immutable storage can't be resized, so the texture names change when
+//   videoFormat() renegotiates the size or chroma.
+{
+    deleteTextures();
+
+    GLsizei planes = isPlanar() ? image.planes : 1;
+    for (int k = 0; k < TEXTURE_COUNT; k++)
+        GL.GenTextures(planes, res->textures[k].planes);
+    res->front = -1;
+    res->storageValid = true;
+
+    IFTRACE(video)
+        debug() << TEXTURE_COUNT << " textures of " << w << "x" << h
+                << ", " << planes << " plane(s) each, first one is #"
+                << res->textures[0].planes[0] << "\n";
+}
+
+
+void VideoTrack::deleteTextures()
+// ----------------------------------------------------------------------------
+//   Delete the ring of textures and their fences
+// ----------------------------------------------------------------------------
+{
+    for (int k = 0; k < TEXTURE_COUNT; k++)
+    {
+        Texture &t = res->textures[k];
+        for (unsigned p = 0; p < 3; p++)
+            if (t.planes[p])
+                GL.DeleteTextures(1, &t.planes[p]);
+        if (t.used)
+            glDeleteSync(t.used);
+    }
+    memset(res->textures, 0, sizeof(res->textures));
+}
+
+
+void VideoTrack::genPBO()
+// ----------------------------------------------------------------------------
+//   Create a ring of GL Pixel Buffer Objects for asynchronous transfers
+// ----------------------------------------------------------------------------
+//   The number of PBOs can be set with TAO_VLC_PBO_COUNT (default 3).
+{
+    XL_ASSERT(image.size);
+    GLuint t = GL_PIXEL_UNPACK_BUFFER;
+
+    int count = DEFAULT_PBO_COUNT;
+    if (const char *env = getenv("TAO_VLC_PBO_COUNT"))
+        count = qBound(1, atoi(env), (int) MAX_PBO_COUNT);
+    res->pbos.fill(0, count);
+    res->pboFences.fill(0, count);
+
+    // Assure we save and restore settings to avoid
+    // conflict with Tao GL states
+    glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+    GL.GenBuffers(count, res->pbos.data());
+    foreach (GLuint pbo, res->pbos)
+    {
+        GL.BindBuffer(t, pbo);
+        GL.BufferData(t, image.size, NULL, GL_STREAM_DRAW);
+    }
+    res->curPBO = 0;
+    res->pboSize = image.size;
+
+    // Restore saved settings
+    glPopClientAttrib();
+
+    IFTRACE(video)
+        debug() << count << " PBOs of " << image.size << " bytes allocated, "
+                << "first one is #" << res->pbos[0] << "\n";
+}
+
+
+void VideoTrack::deletePBO()
+// ----------------------------------------------------------------------------
+//   Delete the ring of PBOs and their fences
+// ----------------------------------------------------------------------------
+{
+    foreach (GLsync fence, res->pboFences)
+        if (fence)
+            glDeleteSync(fence);
+    if (!res->pbos.isEmpty())
+        GL.DeleteBuffers(res->pbos.size(), res->pbos.data());
+    res->pbos.clear();
+    res->pboFences.clear();
+    res->pboSize = 0;
+}
+
+
+void VideoTrack::genMappedBuffer()
+// ----------------------------------------------------------------------------
+//   Create a persistently mapped buffer and let libVLC decode into it
+// ----------------------------------------------------------------------------
+{
+    XL_ASSERT(image.size);
+
+    // Frames in the previous buffer were for a format that is gone
+    if (mappedBuffer)
+    {
+        IFTRACE(video)
+            debug() << "Frame size changed, replacing mapped buffer\n";
+        deleteMappedBuffer();
+        foreach (void *frame, retired)
+            freeFrame(frame);
+        retired.clear();
+    }
+
+    GLuint t = GL_PIXEL_UNPACK_BUFFER;
+    unsigned count = FRAME_COUNT;
+    unsigned stride = FramePool::stride(image.size);
+    GLsizeiptr bytes = GLsizeiptr(stride) * count;
+    GLbitfield flags = (GL_MAP_WRITE_BIT      |
+                        GL_MAP_PERSISTENT_BIT |
+                        GL_MAP_COHERENT_BIT);
+
+    // Assure we save and restore settings to avoid
+    // conflict with Tao GL states
+    glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+    GL.GenBuffers(1, &mappedBuffer);
+    GL.BindBuffer(t, mappedBuffer);
+    glBufferStorage(t, bytes, NULL, flags);
+    mappedBase = (char *) glMapBufferRange(t, 0, bytes, flags);
+    glPopClientAttrib();
+
+    if (!mappedBase)
+    {
+        IFTRACE(video)
+            debug() << "Cannot map buffer, falling back to PBOs\n";
+        GL.DeleteBuffers(1, &mappedBuffer);
+        mappedBuffer = 0;
+        mappedBase = NULL;
+        zeroCopy = false;
+        pool.configure(image.size, FRAME_COUNT);
+        genPBO();
+        return;
+    }
+
+    fences.fill(0, count);
+    mappedStride = stride;
+    mappedContext = QGLContext::currentContext();
+    pool.adopt(mappedBase, stride, count);
+
+    IFTRACE(video)
+        debug() << "Mapped buffer allocated: #" << mappedBuffer << ", "
+                << count << " frames of " << stride << " bytes\n";
+}
+
+
+void VideoTrack::deleteMappedBuffer()
+// ----------------------------------------------------------------------------
+//   Wait until the GPU is done with the mapped buffer, then delete it
+// ----------------------------------------------------------------------------
+//   The pool may still hand out frames of the buffer until a new one is
+//   adopted, so this is only called once videoFormat() retired it.
+{
+    if (!mappedBuffer)
+        return;
+
+    IFTRACE(video)
+        debug() << "Deleting mapped buffer\n";
+    foreach (GLsync fence, fences)
+    {
+        if (fence)
+        {
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT);
+            glDeleteSync(fence);
+        }
+    }
+    fences.clear();
+    glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+    GL.BindBuffer(GL_PIXEL_UNPACK_BUFFER, mappedBuffer);
+    GL.UnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glPopClientAttrib();
+    GL.DeleteBuffers(1, &mappedBuffer);
+    mappedBuffer = 0;
+    mappedBase = NULL;
+    mappedStride = 0;
+}
+
+
+void VideoTrack::stop()
+{
+    videoAvailableInTexture = false;
+}
+
+
+
+void * VideoTrack::lockFrame(void *obj, void **plane)
+// ----------------------------------------------------------------------------
+//   Hand out a pre-allocated frame to libVLC
+// ----------------------------------------------------------------------------
+{
+    VideoTrack *v = (VideoTrack *)obj;
+    XL_ASSERT(v->layout.size);
+
+    char *frame = (char *) v->pool.acquire();
+    for (unsigned p = 0; p < v->layout.planes; p++)
+        plane[p] = frame + v->layout.plane[p].offset;
+    return frame;
+}
+
+
+void VideoTrack::displayFrame(void *obj, void *picture)
+// ----------------------------------------------------------------------------
+//   Copy frame to texture
+// ----------------------------------------------------------------------------
+{
+    VideoTrack *v = (VideoTrack *)obj;
+    XL_ASSERT(v->w && v->h && "Invalid video size");
+
+    if (v->dropFrames())
+    {
+        v->freeFrame(picture);
+        return;
+    }
+
+    if (v->state() != VlcVideoBase::VS_PLAYING &&
+        v->state() != VlcVideoBase::VS_PAUSED &&
+        v->state() != VlcVideoBase::VS_STOPPED)
+        v->setState(VlcVideoBase::VS_PLAYING);
+
+    if (v->earlyConvert)
+        picture = v->convertFrame(picture);
+
+    if (v->keepsFrames())
+        v->postFrame(picture);
+    else
+        v->displayFrameNoPBO(picture);
+
+}
+
+
+void *VideoTrack::convertFrame(void *picture)
+// ----------------------------------------------------------------------------
+//   Convert picture to GL format in a new frame, on the libVLC thread
+// ----------------------------------------------------------------------------
+{
+    void *converted = pool.acquire();
+
+    QElapsedTimer timer;
+    timer.start();
+#if defined(Q_OS_MACX)
+    if (layout.chroma == UYVY)
+        verticalFlip16(converted, picture, w, h);
+    else
+#endif
+        convertToGLFormat(converted, picture, w, h);
+    convertTiming.add(timer.nsecsElapsed());
+    freeFrame(picture);
+    return converted;
+}
+
+
+void VideoTrack::freeFrame(void *picture)
+// ----------------------------------------------------------------------------
+//   Release video memory
+// ----------------------------------------------------------------------------
+{
+    pool.release(picture);
+}
+
+
+void VideoTrack::displayFrameNoPBO(void *picture)
+// ----------------------------------------------------------------------------
+//   Convert picture when Pixel Buffer Objects are NOT enabled
+// ----------------------------------------------------------------------------
+//   The picture is converted into a buffer of 'staging'. With the frames
+//   in the queue and the one being displayed, it has QUEUE_SIZE + 2.
+{
+    void *back = staging.acquire();
+
+    QElapsedTimer timer;
+    timer.start();
+#if defined(Q_OS_MACX)
+    if (layout.chroma == UYVY)
+        verticalFlip16(back, picture, w, h);
+    else
+#endif
+        convertToGLFormat(back, picture, w, h);
+    convertTiming.add(timer.nsecsElapsed());
+    freeFrame(picture);
+
+    postFrame(back);
+}
+
+
+void VideoTrack::postFrame(void *frame)
+// ----------------------------------------------------------------------------
+//   Queue frame for upload, stamped with the time it is due
+// ----------------------------------------------------------------------------
+//   Frames are in one of three places: the one libVLC or convertFrame() is
+//   writing, the queue, and the one in image.ptr (render thread).
+//   Neither thread waits for the other.
+{
+    if (loopCache)
+        loopCache->record(frame, layout.size);
+
+    queueFrame(frame);
+    if (threadedUpload)
+        VideoUploader::post(this);
+    else
+        VlcVideoBase::wakeUp();
+}
+
+
+void VideoTrack::queueFrame(void *frame)
+// ----------------------------------------------------------------------------
+//   libVLC thread: append frame to the queue, evicting the oldest if full
+// ----------------------------------------------------------------------------
+//   The queue has a single producer, the libVLC thread, and consumers that
+//   take frames by moving queueHead with a compare-and-swap. Whoever moves
+//   it past a frame owns that frame. If nothing was taken for QUEUE_SIZE
+//   frames, e.g. page not shown, the producer takes the oldest frame that
+//   way and drops it: the newest frame wins, and no thread ever locks.
+//   Frames are stamped with the time they are due, see takeFrame(). Those
+//   asked by VlcVideoSurface::stepTo() have their media time instead.
+{
+    bool stepped = parent->stepping.loadAcquire();
+    qint64 now = stepped ? parent->steppedFrameTime() : monotonicTime();
+    if (!stepped)
+    {
+        // Published whole, fps() reads it from other threads
+        qint64 period = averagePeriod(framePeriod.load(), lastArrival, now);
+        framePeriod.store(period);
+        if (!threadedUpload)
+            now += VlcVideoSurface::PRESENT_DELAY * 1000000LL;
+    }
+
+    int tail = queueTail.load();
+    for (;;)
+    {
+        int head = queueHead.loadAcquire();
+        if (tail - head < QUEUE_SIZE)
+            break;
+        void *oldest = queue[head % QUEUE_SIZE].frame;
+        if (queueHead.testAndSetOrdered(head, head + 1))
+        {
+            superseded.fetchAndAddRelaxed(1);
+            dropFrame(oldest);
+            break;
+        }
+    }
+    QueuedFrame &q = queue[tail % QUEUE_SIZE];
+    q.frame = frame;
+    q.seq = layout.seq;
+    q.time = now;
+    queueTail.storeRelease(tail + 1);
+    if (stepped)
+        parent->steppedFrameQueued();
+}
+
+
+void *VideoTrack::takeFrame(qint64 swapTime)
+// ----------------------------------------------------------------------------
+//   Take the queued frame to show at swapTime, skipping older ones
+// ----------------------------------------------------------------------------
+//   libVLC delivers frames at their display time, so all of them arrived
+//   before the next swap, and the newest one would always win. Instead,
+//   frames are due PRESENT_DELAY after they arrive, and the audio is
+//   delayed as much, see VlcVideoSurface::startPlayback(). The frame due
+//   closest to swapTime wins, unless the frame already shown is closer,
+//   so frames are shown for a number of swaps that follows the video rate.
+//   A negative swapTime takes the newest frame. Stepped frames have their
+//   media time, and are shown at that time. Frames in a format older than
+//   image.seq are dropped, frames in a newer one wait for applyLayout().
+//   See queueFrame() for how frames change hands.
+{
+    for (;;)
+    {
+        int head = queueHead.loadAcquire();
+        int tail = queueTail.loadAcquire();
+        int stale = head;
+        while (stale != tail && queue[stale % QUEUE_SIZE].seq - image.seq < 0)
+            stale++;
+        int end = stale;
+        while (end != tail && queue[end % QUEUE_SIZE].seq == image.seq)
+            end++;
+
+        int k = stale != end ? end - 1 : -1;
+        if (k >= 0 && swapTime >= 0)
+        {
+            qint64 best = image.ptr ? qAbs(shownTime - swapTime) : LLONG_MAX;
+            k = -1;
+            for (int i = stale; i != end; i++)
+            {
+                // Presentation times grow: stop when they move away
+                qint64 d = qAbs(queue[i % QUEUE_SIZE].time - swapTime);
+                if (d > best)
+                    break;
+                best = d;
+                k = i;
+            }
+        }
+        int next = k >= 0 ? k + 1 : stale;
+        if (next == head)
+            return NULL;
+
+        // Read the slots before taking them: once queueHead moved past
+        // them, the producer may write them again
+        void *frames[QUEUE_SIZE];
+        for (int i = head; i != next; i++)
+            frames[i - head] = queue[i % QUEUE_SIZE].frame;
+        qint64 time = queue[(next - 1) % QUEUE_SIZE].time;
+        if (!queueHead.testAndSetOrdered(head, next))
+            continue;           // The producer evicted the oldest frame
+
+        int last = k >= 0 ? next - 1 : next;
+        for (int i = head; i != last; i++)
+        {
+            superseded.fetchAndAddRelaxed(1);
+            dropFrame(frames[i - head]);
+        }
+        if (k < 0)
+            return NULL;
+        shownTime = time;
+        return frames[k - head];
+    }
+}
+
+
+bool VideoTrack::hasFrameAt(qint64 t)
+// ----------------------------------------------------------------------------
+//   When stepping, true if the frame closest to media time t was queued
+// ----------------------------------------------------------------------------
+//   It is known once a frame at or after t arrived. Until then, frames
+//   before the newest one cannot be the closest: drop them to make room.
+{
+    QMutexLocker locker(&mutex);
+    for (;;)
+    {
+        int head = queueHead.loadAcquire();
+        int tail = queueTail.loadAcquire();
+        if (head == tail)
+            return image.ptr && shownTime >= t;
+        if (queue[(tail - 1) % QUEUE_SIZE].time >= t)
+            return true;
+
+        void *frames[QUEUE_SIZE];
+        for (int i = head; i != tail - 1; i++)
+            frames[i - head] = queue[i % QUEUE_SIZE].frame;
+        if (!queueHead.testAndSetOrdered(head, tail - 1))
+            continue;
+        for (int i = head; i != tail - 1; i++)
+        {
+            superseded.fetchAndAddRelaxed(1);
+            dropFrame(frames[i - head]);
+        }
+        return false;
+    }
+}
+
+
+void VideoTrack::dropQueuedFrames()
+// ----------------------------------------------------------------------------
+//   Release all queued frames, e.g. when they have another format
+// ----------------------------------------------------------------------------
+{
+    for (;;)
+    {
+        int head = queueHead.loadAcquire();
+        int tail = queueTail.loadAcquire();
+        void *frames[QUEUE_SIZE];
+        for (int i = head; i != tail; i++)
+            frames[i - head] = queue[i % QUEUE_SIZE].frame;
+        if (!queueHead.testAndSetOrdered(head, tail))
+            continue;
+        for (int i = head; i != tail; i++)
+            dropFrame(frames[i - head]);
+        return;
+    }
+}
+
+
+void VideoTrack::replayFrame(qint64 ms)
+// ----------------------------------------------------------------------------
+//   Post the cached frame shown 'ms' milliseconds after the start of a pass
+// ----------------------------------------------------------------------------
+//   The frame is copied into a frame of the pool, so that uploading and
+//   releasing it work as for frames decoded by libVLC.
+{
+    int k = loopCache->frameAt(ms);
+    if (k < 0 || k == replayed || loopCache->frameSize() != layout.size)
+        return;
+
+    void *frame = keepsFrames() ? pool.acquire() : staging.acquire();
+    memcpy(frame, loopCache->frame(k), layout.size);
+    replayed = k;
+    postFrame(frame);
+}
+
+
+void VideoTrack::retireFrame(void *frame)
+// ----------------------------------------------------------------------------
+//   Release the frame previously in image.ptr, once the GPU is done with it
+// ----------------------------------------------------------------------------
+{
+    if (zeroCopy && frame)
+    {
+        // If the GPU may still be reading it, releaseRetired() will free it
+        int slot = pool.index(frame);
+        if (slot >= 0 && slot < fences.size() && fences[slot])
+        {
+            retired.append(frame);
+            return;
+        }
+    }
+    dropFrame(frame);
+}
+
+
+void VideoTrack::dropFrame(void *frame)
+// ----------------------------------------------------------------------------
+//   Give back a frame to the pool it comes from
+// ----------------------------------------------------------------------------
+{
+    if (keepsFrames())
+        freeFrame(frame);
+    else
+        staging.release(frame);
+}
+
+
+
+// ============================================================================
+//
+//   Uploading textures in a separate thread
+//
+// ============================================================================
+
+VideoUploader * VideoUploader::inst = NULL;
+bool            VideoUploader::failed = false;
+
+
+VideoUploader * VideoUploader::instance()
+// ----------------------------------------------------------------------------
+//   Instance of the singleton, created from the render thread
+// ----------------------------------------------------------------------------
+//   Returns NULL if no context sharing textures with the current one can
+//   be created.
+{
+    if (!inst && !failed)
+    {
+        const QGLContext *main = QGLContext::currentContext();
+        QGLWidget *shared = NULL;
+        if (main)
+            shared = dynamic_cast<QGLWidget *>(main->device());
+        QGLWidget *widget = shared ? new QGLWidget(NULL, shared) : NULL;
+        if (main)
+            const_cast<QGLContext *>(main)->makeCurrent();
+        if (!widget || !widget->isSharing())
+        {
+            IFTRACE(video)
+                std::cerr << "[VideoUploader] No shared GL context, "
+                          << "textures will be uploaded by the render thread\n";
+            delete widget;
+            failed = true;
+            return NULL;
+        }
+
+        inst = new VideoUploader(widget);
+        inst->moveToThread(inst);
+        widget->context()->moveToThread(inst);
+        inst->start();
+    }
+    return inst;
+}
+
+
+void VideoUploader::postTrack(VideoTrack *track)
+// ----------------------------------------------------------------------------
+//   Queue upload of the pending frame of track
+// ----------------------------------------------------------------------------
+{
+    QMutexLocker locker(&mutex);
+    if (!pendingTracks.contains(track))
+        pendingTracks.append(track);
+    cond.wakeAll();
+}
+
+
+void VideoUploader::discardTrack(VideoTrack *track)
+// ----------------------------------------------------------------------------
+//   Forget track, and wait until it is not being uploaded anymore
+// ----------------------------------------------------------------------------
+{
+    QMutexLocker locker(&mutex);
+    pendingTracks.removeAll(track);
+    while (current == track)
+        cond.wait(&mutex);
+}
+
+
+void VideoUploader::stopAndWait()
+// ----------------------------------------------------------------------------
+//   Stop the thread and wait for it to terminate
+// ----------------------------------------------------------------------------
+{
+    mutex.lock();
+    done = true;
+    cond.wakeAll();
+    mutex.unlock();
+    wait();
+}
+
+
+void VideoUploader::run()
+// ----------------------------------------------------------------------------
+//   Main loop run by the thread
+// ----------------------------------------------------------------------------
+{
+    widget->makeCurrent();
+
+    QMutexLocker locker(&mutex);
+    for(;;)
+    {
+        while (pendingTracks.isEmpty() && !done)
+            cond.wait(&mutex);
+
+        if (done)
+            break;
+
+        current = pendingTracks.takeFirst();
+        mutex.unlock();
+        current->uploadFrame();
+        mutex.lock();
+        current = NULL;
+        cond.wakeAll();
+    }
+
+    // The widget is deleted by the main thread
+    widget->doneCurrent();
+    widget->context()->moveToThread(qApp->thread());
+}
+
+
+
+// ============================================================================
+//
+//   Releasing GL objects when a context is destroyed
+//
+// ============================================================================
+
+VideoContextWatcher::VideoContextWatcher(VideoTrack *track,
+                                         const QGLContext *context)
+// ----------------------------------------------------------------------------
+//   Watch destruction of context for track
+// ----------------------------------------------------------------------------
+    : track(track), context(context)
+{
+    // Direct connection, since the context is gone after the signal
+    connect(context->contextHandle(), SIGNAL(aboutToBeDestroyed()),
+            this, SLOT(contextDestroyed()), Qt::DirectConnection);
+}
+
+
+void VideoContextWatcher::contextDestroyed()
+// ----------------------------------------------------------------------------
+//   Release GL objects of the track while the context still exists
+// ----------------------------------------------------------------------------
+{
+    IFTRACE(video)
+        track->debug() << "GL context " << (void *) context
+                       << " destroyed\n";
+    track->releaseContext(context, true);
 }
@@ -39,19 +39,30 @@
 // *****************************************************************************
 
 #include "vlc_video_base.h"
+#include "vlc_frame_pool.h"
+#include "vlc_frame_cache.h"
 #include <qgl.h>
+#include <QGLShaderProgram>
 #include <QString>
 #include <QStringList>
 #include <QMutex>
-#include <QImage>
+#include <QAtomicInteger>
+#include <QElapsedTimer>
 #include <QVector>
-#include <QSet>
+#include <QList>
+#include <QMap>
+#include <QObject>
+#include <QThread>
+#include <QWaitCondition>
 #include <vlc/libvlc.h>
 #include <vlc/libvlc_media.h>
 #include <vlc/libvlc_media_player.h>
+#include <vlc/libvlc_version.h>
 #include <iostream>
+#include <string.h>
 
 struct VideoTrack;
+class  VideoContextWatcher;
 
 struct VlcVideoSurface : VlcVideoBase
 // ----------------------------------------------------------------------------
@@ -69,6 +80,12 @@ public:
     virtual void   exec();
     VideoTrack *   currentVideoTrack();
     bool           setVideoTrack(int id);
+    void           setRegion(float x, float y, float w, float h);
+    void           setGpuScaling(bool on);
+    void           setLoopCache(unsigned megabytes);
+    virtual float  fps();
+    double         uploadTime();
+    bool           stepTo(double t);
 
     // Info re. current video track
     GLuint         texture();
@@ -85,18 +102,59 @@ protected:
     int                     vtId;        // Current track id (-1: none)
     int                     nextVtId;    // Next available id for unumbered tracks
     bool                    usePBO;
+    bool                    zeroCopy;    // Decode into mapped GL buffers
+    bool                    convert;     // Swap R/B and flip on the CPU
+    bool                    planar;      // Accept I420/NV12, convert on GPU
+    bool                    earlyConvert; // Convert in libVLC thread
+    bool                    adaptive;    // Decode size follows screen size
+    bool                    gpuScale;    // Decode at native size, GPU scales
+    bool                    threadedUpload; // See VideoUploader
+    float                   cropX, cropY, cropW, cropH; // See setRegion()
+    VideoTrack *            renegotiating; // Track restarted by adaptSize()
+    QElapsedTimer           renegotiateClock; // Since restartVideo()
+    int                     renegotiateShift; // decodeShift before that
+    size_t                  loopCacheLimit; // Bytes, see setLoopCache()
+    bool                    replaying;   // Passes after the first one
+    QElapsedTimer           replayClock;
+    double                  replayTime;  // In the replayed pass, in ms
     bool                    dropFrames;
+    QAtomicInt              stepping;    // Offline: frames asked one by one
+    double                  stepPeriod;  // Between frames, in s of media
+    double                  stepOrigin;  // Media time of first frame, in s
+    double                  stepTarget;  // Media time to show, in s
+    unsigned                stepRequested; // Asked to libVLC, not arrived
+    QMutex                  stepMutex;
+    QWaitCondition          stepReady;   // A stepped frame was queued
     QMutex                  mutex;       // make videoFormat() thread-safe
 
 
+protected:
+    enum { STEP_TIMEOUT = 2000, STEP_SLICE = 50, // ms, see stepTo()
+           STEP_SEEK = 1000 };  // Seek rather than step further, in ms
+    enum { RENEGOTIATE_TIMEOUT = 3000 }; // ms, see renegotiationPending()
+    enum { PRESENT_DELAY = 40 };  // ms, see VideoTrack::takeFrame()
+
 protected:
     virtual void   startPlayback();
+    virtual bool   seekCached(double t);
 
+    void           adaptSize();
+    bool           restartVideo(VideoTrack *t);
+    bool           renegotiationPending();
+    bool           startReplay();
+    void           replay();
+    void           startStepping(double t);
+    void           stopStepping();
+    void           requestSteps(VideoTrack *t);
+    qint64         steppedFrameTime();
+    void           steppedFrameQueued();
     void           startGetMediaInfo();
     void           getMediaSubItems();
     std::ostream & debug();
     void           updateTexture();
     int            newTrack(int es_id);
+    void           colorimetry(int es_id, unsigned height, const char *chroma,
+                               bool *bt709, bool *fullRange);
 
 protected:
     static unsigned videoFormat(void **opaque, char *chroma,
@@ -126,59 +184,273 @@ public:
     static void    delete_callback(void *arg);
 
 public:
-    unsigned       width()   { return w; }
-    unsigned       height()  { return h; }
+    unsigned       width()   { return cropW > 0 ? cropW : displayW; }
+    unsigned       height()  { return cropH > 0 ? cropH : displayH; }
+    double         fps()
+    {
+        qint64 period = framePeriod.load();
+        return period ? 1e9 / period : 0;
+    }
     GLuint         texture();
     void           updateTexture();
     void           stop();
+    void           setRegion(float x, float y, float w, float h);
     void           ref()     { refs++; }
     void           unref()   { if (--refs == 0) delete this; }
 
 protected:
-    enum Chroma { INVALID, RV32, UYVY };
+    enum Chroma { INVALID, RV32, UYVY, I420, NV12 };
+    enum { DEFAULT_PBO_COUNT = 3, MAX_PBO_COUNT = 16, TEXTURE_COUNT = 3 };
+    enum { FENCE_TIMEOUT = 100000000 }; // ns, see deleteMappedBuffer()
+    enum { QUEUE_SIZE = 4,    // Frames posted and not taken yet
+           FRAME_COUNT = FramePool::DEFAULT_COUNT + QUEUE_SIZE };
+    // Each change of decoded size restarts the video output, and the
+    // picture then freezes until the next keyframe (up to a few seconds
+    // with long GOPs). Hence sizes only change after that many frames
+    // wanting it, and reducing the size waits longer than enlarging it.
+    enum { MAX_DECODE_SHIFT = 3, MIN_DECODE_SIZE = 64,
+           ADAPT_UP_FRAMES = 5, ADAPT_DOWN_FRAMES = 60 };
+
+    struct Plane
+    {
+        void       set(unsigned o, unsigned p, unsigned w, unsigned h)
+        {
+            offset = o; pitch = p; width = w; height = h;
+        }
+
+        unsigned   offset;    // bytes from start of frame
+        unsigned   pitch;     // bytes per row
+        unsigned   width;     // texels
+        unsigned   height;
+    };
 
     struct ImageBuf
     {
-        ImageBuf() : ptr(NULL), size(0), chroma(INVALID) {}
+        ImageBuf() : ptr(NULL), size(0), chroma(INVALID), planes(1),
+                     bt709(false), fullRange(false), mipmaps(false),
+                     seq(0) {}
 
-        void     * ptr;       // No PBO: converted.bits() / PBO: unconverted
+        void     * ptr;       // Frame from 'pool', or 'staging' if converted
         unsigned   size;      // bytes
         Chroma     chroma;
-        QImage     converted; // RV32 -> GL_RGBA or flip YUVY
+        unsigned   planes;    // 3 for I420, 2 for NV12, else 1
+        Plane      plane[3];
+        bool       bt709;     // Else BT.601
+        bool       fullRange; // Else 16-235 (limited)
+        bool       mipmaps;   // GPU scaling down
+        int        seq;       // Counts changes of format, see setFormat()
+    };
+
+    struct Region
+    {
+        bool       operator==(const Region &o) const
+        {
+            return x == o.x && y == o.y && width == o.width &&
+                height == o.height;
+        }
+        bool       operator!=(const Region &o) const { return !(*this == o); }
+
+        unsigned   x, y;      // Top left, in texels of the first plane
+        unsigned   width;
+        unsigned   height;
+    };
+
+    struct Texture
+    {
+        GLuint     planes[3]; // RGB, or Y and chroma planes
+        GLsync     used;      // Signaled when the GPU is done drawing it
+        bool       drawn;     // Drawn since 'used' was set
+        bool       allocated; // Has storage for the current format
+        Region     region;    // Part of the frame it holds, at (0, 0)
+    };
+
+    struct PlaneFormat
+    {
+        GLenum     internal;  // Format of the texture storage
+        GLenum     format;    // Format and type of the pixels in frames
+        GLenum     type;
+        GLsizei    width;     // Size of the plane, and of the storage
+        GLsizei    height;
+        GLint      alignment; // GL_UNPACK_ALIGNMENT
+        GLint      skipPixels; // Rectangle to upload, see textureRegion()
+        GLint      skipRows;
+        GLsizei    subWidth;
+        GLsizei    subHeight;
+    };
+
+    struct GLResources
+    {
+        GLResources() : front(-1), storageValid(false),
+                        yuvShader(NULL), yuvShaderReady(false),
+                        rgbTexture(0), rgbFramebuffer(0), rgbValid(false),
+                        curPBO(0), pboSize(0), uploaded(0), watcher(NULL)
+        {
+            memset(textures, 0, sizeof(textures));
+        }
+
+        Texture                 textures[TEXTURE_COUNT];
+        int                     front;          // Newest uploaded, or -1
+        bool                    storageValid;   // Textures sized for image
+        QGLShaderProgram      * yuvShader;
+        bool                    yuvShaderReady; // Uniforms are set
+        GLuint                  rgbTexture;     // Planar: front as RGB
+        GLuint                  rgbFramebuffer; // Renders into rgbTexture
+        bool                    rgbValid;       // rgbTexture sized for image
+        QVector<GLuint>         pbos;           // Ring of PBOs
+        QVector<GLsync>         pboFences;      // GPU still reading the PBO
+        int                     curPBO;         // Next PBO to try
+        unsigned                pboSize;
+        quint64                 uploaded;       // Sequence of frame uploaded
+        VideoContextWatcher   * watcher;        // Tells when context dies
+    };
+    typedef QMap<const QGLContext *, GLResources *> GLResourcesMap;
+
+    struct QueuedFrame
+    {
+        void *     frame;
+        int        seq;       // Format of the frame, see ImageBuf::seq
+        qint64     time;      // Due, in ns, see monotonicTime(),
+                              // or media time when stepping
+    };
+
+    struct Timing
+    {
+        Timing() : nsecs(0), count(0) {}
+        void     add(qint64 ns) { nsecs += ns; count++; }
+        double   average()      { return count ? nsecs / 1e3 / count : 0; }
+
+        qint64     nsecs;
+        unsigned   count;
     };
 
 protected:
     VlcVideoSurface       * parent;
     unsigned                id;
-    unsigned                w, h;
+    unsigned                w, h;           // Decoded (texture) size
+    unsigned                requestW, requestH; // Size asked, 0 if native
     float                   wscale, hscale;
-    GLuint                  textureId;
-    QMutex                  mutex;  // Protect 'image' and 'updated'
-    ImageBuf                image;
-    QImage                  converted;
-    bool                    updated;
-    bool                    videoAvailable;          // In ImageBuf
+    unsigned                displayW, displayH; // Reported size
+    int                     decodeShift;    // Adaptive: decode at 1/2^n
+    unsigned                adaptFrames;    // Frames wanting another size
+    double                  projectedW, projectedH; // Size on screen
+    float                   cropX, cropY, cropW, cropH; // Region shown
+    Region                  roi;            // Region uploaded
+    GLResourcesMap          contexts;          // GL objects per context
+    GLResources           * res;               // Those of current context
+    GLResources             upload;            // Ring of VideoUploader
+    int                     back;              // Texture being uploaded
+    int                     ready;             // Uploaded by thread, or -1
+    GLsync                  readyFence;        // Signaled when 'ready' is
+    unsigned                uploadStorage;     // Rings made for 'upload'
+    unsigned                ringExhausted;     // No texture was free
+    bool                    gpuScale;          // Shown size != decoded
+    QMutex                  mutex;  // Protect 'layout'
+    ImageBuf                layout; // Format decoded now (libVLC thread)
+    ImageBuf                image;  // Frame to upload and its format
+    QueuedFrame             queue[QUEUE_SIZE]; // Posted, not yet taken
+    QAtomicInt              queueHead;      // Next to take, moved by CAS
+    QAtomicInt              queueTail;      // Next to post (libVLC thread)
+    qint64                  lastArrival;    // libVLC thread
+    QAtomicInteger<qint64>  framePeriod;    // Between frames, in ns (EMA)
+    qint64                  lastRender;     // Render thread
+    qint64                  renderPeriod;   // Between swaps, in ns
+    qint64                  shownTime;      // Time of frame in image.ptr
+    QAtomicInt              superseded;     // Frames never taken
+    unsigned                repeated;       // Renders without a new frame
+    quint64                 frameSeq;       // Sequence of image.ptr
     bool                    videoAvailableInTexture;
     bool                    usePBO;
+    bool                    zeroCopy;
+    bool                    convert;
+    bool                    earlyConvert;
+    bool                    threadedUpload;
+    bool                    native;  // Texture rows as from libVLC (BGRA)
     const QGLContext      * GLcontext;
-    GLuint                  pbo[2];
-    int                     curPBO;
-    GLubyte               * curPBOPtr;
-    QSet<void *>            allocatedFrames;
+    unsigned                pboWaits;       // Uploads delayed, all PBOs busy
+    GLuint                  mappedBuffer;   // Zero-copy: frames of the pool
+    char                  * mappedBase;
+    unsigned                mappedStride;   // Size of slots in mappedBuffer
+    const QGLContext      * mappedContext;
+    QVector<GLsync>         fences;         // Zero-copy: upload of each slot
+    QVector<void *>         retired;        // Zero-copy: frames to release
+    FramePool               pool;   // Frames handed out to libVLC
+    FramePool               staging;        // No PBO: front and back buffers
+    Timing                  convertTiming;  // CPU conversion, in us
+    Timing                  uploadTiming;   // Texture transfer, in us
+    FrameCache            * loopCache;      // Frames of the first pass
+    int                     replayed;       // Frame of loopCache shown
     unsigned                refs;
     double                  frameTime;
 
 protected:
     std::ostream & debug();
     void           checkGLContext();
-    void           genTexture();
+    void           releaseContext(const QGLContext *context, bool destroyed);
+    void           deleteResources();
+    void           projectSize();
+    int            adaptShift();
+    int            nextTexture();
+    void           fenceFront();
+    int            freeTexture();
+    void           deleteTextures();
     void           genPBO();
+    void           deletePBO();
+    void           genMappedBuffer();
+    void           deleteMappedBuffer();
     void           transferPBO();
     void           transferNoPBO();
-    void           doGLTexImage2D();
+    void           transferMapped();
+    void           releaseRetired();
+    void           uploadFrame();
+    void           takeUpload();
+    void           genUploadStorage();
+    void           deleteUploadStorage();
+    GLResources *  ring() { return threadedUpload ? &upload : res; }
+    void           doGLTexImage2D(const void *pixels);
+    bool           needsUpload()
+    {
+        return image.ptr && (!res || res->uploaded != frameSeq);
+    }
+    Region         textureRegion();
+    PlaneFormat    planeFormat(const ImageBuf &format, unsigned plane,
+                               const Region &r);
+    PlaneFormat    planeFormat(unsigned plane, const Region &r)
+    {
+        return planeFormat(image, plane, r);
+    }
+    void           copyRegion(void *to, const void *from, const Region &r);
+    void           texSubImage(Texture &t, unsigned plane,
+                               const PlaneFormat &f, const void *pixels);
+    void           genStorage();
+    void           genYuvShader();
+    void           setYuvUniforms();
+    bool           convertYuv();
+    void           setFormat(Chroma chroma, bool bt709, bool fullRange,
+                             bool mipmaps);
+    void           applyLayout();
+    double         frameCost();
+    static GLsizei mipmapLevels(GLsizei w, GLsizei h);
+    static bool    hasSwizzle()
+    {
+        return GLEW_ARB_texture_swizzle || GLEW_VERSION_3_3;
+    }
+    bool           isPlanar() { return image.planes > 1; }
     void           displayFrameNoPBO(void *picture);
-    void           displayFramePBO(void *picture);
+    void           postFrame(void *frame);
+    void           queueFrame(void *frame);
+    bool           hasQueuedFrames()
+    {
+        return queueHead.loadAcquire() != queueTail.loadAcquire();
+    }
+    void *         takeFrame(qint64 swapTime);
+    bool           hasFrameAt(qint64 t);
+    void           dropQueuedFrames();
+    void           replayFrame(qint64 ms);
+    void           retireFrame(void *frame);
+    void           dropFrame(void *frame);
     void           freeFrame(void *picture);
+    void *         convertFrame(void *picture);
+    bool           keepsFrames() { return usePBO || !convert; }
     VlcVideoBase::State
                    state() { return parent->state; }
     void           setState(VlcVideoBase::State s) { parent->_setState(s); }
@@ -189,6 +461,83 @@ protected:
     static void    displayFrame(void *obj, void *picture);
 
     friend struct VlcVideoSurface;
+    friend struct VideoUploader;
+    friend class  VideoContextWatcher;
+};
+
+
+
+class VideoContextWatcher : public QObject
+// ----------------------------------------------------------------------------
+//  Release the GL objects of a video track when a GL context is destroyed
+// ----------------------------------------------------------------------------
+{
+    Q_OBJECT
+
+public:
+    VideoContextWatcher(VideoTrack *track, const QGLContext *context);
+
+public slots:
+    void                    contextDestroyed();
+
+protected:
+    VideoTrack *            track;
+    const QGLContext *      context;
+};
+
+
+
+struct VideoUploader : public QThread
+// ----------------------------------------------------------------------------
+//  Singleton uploading frames of video tracks in a shared GL context
+// ----------------------------------------------------------------------------
+//  Enabled with TAO_VLC_UPLOAD_THREAD. Tracks are posted by displayFrame(),
+//  uploaded by VideoTrack::uploadFrame(), and the render thread only swaps
+//  textures in VideoTrack::takeUpload().
+{
+    VideoUploader(QGLWidget *widget) : widget(widget), current(NULL),
+                                       done(false) {}
+    virtual ~VideoUploader() { delete widget; }
+
+public:
+    static VideoUploader *  instance();
+    static void post(VideoTrack *track)
+    {
+        if (inst)
+            inst->postTrack(track);
+    }
+    static void discard(VideoTrack *track)
+    {
+        if (inst)
+            inst->discardTrack(track);
+    }
+    static void stop()
+    {
+        VideoUploader *& inst = VideoUploader::inst;
+        if (!inst)
+            return;
+        inst->stopAndWait();
+        delete inst;
+        inst = NULL;
+    }
+
+protected:
+    void                    postTrack(VideoTrack *track);
+    void                    discardTrack(VideoTrack *track);
+    void                    stopAndWait();
+    void                    run();
+
+protected:
+    static VideoUploader *  inst;
+    static bool             failed;   // No shared context, don't try again
+
+protected:
+    QGLWidget *             widget;   // Owns the context of the thread
+    QList<VideoTrack *>     pendingTracks;
+    VideoTrack *            current;  // Track being uploaded
+    QMutex                  mutex;
+    QWaitCondition          cond;
+    bool                    done;
 };
 
 #endif // VLC_VIDEO_SURFACE_H